@@ -0,0 +1,119 @@
+#include "AtChannel.h"
+
+// Lines reported as URCs when they arrive outside the exchange waiting on them
+static const char* const AT_URC_PREFIXES[] = {
+    "+QHTTPGET:", "+QHTTPREAD:", "+QIURC:", "+QSSLURC:", "+CEREG:", "+CGREG:", "+QIND:",
+    "RDY", "POWERED DOWN", "+CPIN: NOT READY"
+};
+
+// Appends c to the current line. Returns true when p.line holds a complete,
+// non-empty line (NUL terminated, CR/LF stripped). Overlong lines are
+// truncated rather than split.
+bool atFeed(AtParser& p, char c) {
+    if (c == '\r') return false;
+    if (c == '\n') {
+        bool complete = p.len > 0;
+        p.line[p.len] = 0;
+        p.len = 0;
+        p.overflow = false;
+        return complete;
+    }
+    if (p.len < AT_LINE_MAX - 1) p.line[p.len++] = c;
+    else p.overflow = true;
+    return false;
+}
+
+AtLineKind atClassify(const char* line) {
+    if (strcmp(line, "OK") == 0) return AT_LINE_OK;
+    if (strcmp(line, "ERROR") == 0 || strncmp(line, "+CME ERROR", 10) == 0 ||
+        strncmp(line, "+CMS ERROR", 10) == 0) return AT_LINE_ERROR;
+    if (strncmp(line, "CONNECT", 7) == 0) return AT_LINE_CONNECT;
+    for (size_t i = 0; i < sizeof(AT_URC_PREFIXES) / sizeof(AT_URC_PREFIXES[0]); i++) {
+        if (strncmp(line, AT_URC_PREFIXES[i], strlen(AT_URC_PREFIXES[i])) == 0) return AT_LINE_URC;
+    }
+    return AT_LINE_INFO;
+}
+
+// Reads modem lines until one contains expected, a final error arrives, or
+// (with stopOnOk) a final OK arrives first. The matching line stays in
+// ch.parser.line for the caller to parse. Returns on the CONNECT line itself
+// so the data that follows is left unread on the link.
+AtResult atWaitFor(AtChannel& ch, const char* expected, uint32_t timeout, bool stopOnOk) {
+    CellLink& link = *ch.link;
+    uint32_t start = link.millis();
+    while (link.waitForData(start, timeout)) {
+        while (link.available()) {
+            if (!atFeed(ch.parser, (char)link.read())) continue;
+
+            const char* line = ch.parser.line;
+            if (expected && strstr(line, expected)) return AT_MATCH;
+
+            switch (atClassify(line)) {
+                case AT_LINE_OK:
+                    if (stopOnOk) return AT_OK;
+                    break;
+                case AT_LINE_ERROR:
+                    return AT_ERROR;
+                case AT_LINE_URC:
+                    atDispatchUrc(ch, line);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    return AT_TIMEOUT;
+}
+
+// Sends cmd (if any) and waits for a line containing expected. Gives up early
+// on a final result code that arrives first.
+bool atSend(AtChannel& ch, const char* cmd, const char* expected, uint32_t timeout) {
+    if (cmd && *cmd) ch.link->println(cmd);
+    if (atWaitFor(ch, expected, timeout, true) != AT_MATCH) return false;
+    // Matched an intermediate line: eat the trailing OK so it cannot satisfy
+    // the next command's wait
+    AtLineKind kind = atClassify(ch.parser.line);
+    if (kind == AT_LINE_INFO || kind == AT_LINE_URC) atWaitFor(ch, NULL, 300, true);
+    return true;
+}
+
+// Sends cmd and copies the first response line starting with prefix into out,
+// then consumes the final result. False if the modem answered without it.
+bool atQuery(AtChannel& ch, const char* cmd, const char* prefix, char* out, size_t outLen, uint32_t timeout) {
+    ch.link->println(cmd);
+    while (true) {
+        AtResult r = atWaitFor(ch, prefix, timeout, true);
+        if (r != AT_MATCH) return false;
+        if (strncmp(ch.parser.line, prefix, strlen(prefix)) == 0) break;
+    }
+    strncpy(out, ch.parser.line, outLen - 1);
+    out[outLen - 1] = 0;
+    atWaitFor(ch, NULL, 300, true);
+    return true;
+}
+
+// Registers a handler for URCs starting with prefix (string must outlive the
+// registration). Returns false when all slots are taken.
+bool atOnUrc(AtChannel& ch, const char* prefix, AtUrcHandler handler) {
+    for (int i = 0; i < AT_URC_SLOTS; i++) {
+        AtUrcSlot& slot = ch.urcSlots[i];
+        if (slot.prefix == NULL || strcmp(slot.prefix, prefix) == 0) {
+            slot.prefix = prefix;
+            slot.handler = handler;
+            return true;
+        }
+    }
+    return false;
+}
+
+// False if no handler claims line.
+bool atDispatchUrc(AtChannel& ch, const char* line) {
+    for (int i = 0; i < AT_URC_SLOTS; i++) {
+        AtUrcSlot& slot = ch.urcSlots[i];
+        if (slot.prefix && strncmp(line, slot.prefix, strlen(slot.prefix)) == 0) {
+            slot.handler(line);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "CellLink.h"
+
+// Incremental AT line parser. One fixed buffer, no String, bytes consumed one
+// at a time so nothing past a CONNECT line is swallowed.
+#define AT_LINE_MAX   256
+#define AT_URC_SLOTS  4
+
+enum AtLineKind {
+    AT_LINE_INFO,      // Intermediate response (e.g. "+CPIN: READY")
+    AT_LINE_OK,        // Final result: OK
+    AT_LINE_ERROR,     // Final result: ERROR / +CME ERROR / +CMS ERROR
+    AT_LINE_CONNECT,   // Data mode follows immediately
+    AT_LINE_URC        // Unsolicited result code
+};
+
+enum AtResult {
+    AT_TIMEOUT,
+    AT_MATCH,          // A line containing the expected token arrived
+    AT_OK,             // Final OK before the expected token
+    AT_ERROR           // Final error result
+};
+
+typedef void (*AtUrcHandler)(const char* line);
+
+struct AtParser {
+    char line[AT_LINE_MAX];
+    size_t len;
+    bool overflow;
+};
+
+struct AtUrcSlot {
+    const char* prefix;
+    AtUrcHandler handler;
+};
+
+// A link plus the parser state and URC handlers of the exchange running on it
+struct AtChannel {
+    CellLink* link;
+    AtParser parser;
+    AtUrcSlot urcSlots[AT_URC_SLOTS];
+};
+
+bool atFeed(AtParser& p, char c);
+AtLineKind atClassify(const char* line);
+AtResult atWaitFor(AtChannel& ch, const char* expected, uint32_t timeout, bool stopOnOk);
+bool atSend(AtChannel& ch, const char* cmd, const char* expected, uint32_t timeout);
+bool atQuery(AtChannel& ch, const char* cmd, const char* prefix, char* out, size_t outLen, uint32_t timeout);
+bool atOnUrc(AtChannel& ch, const char* prefix, AtUrcHandler handler);
+bool atDispatchUrc(AtChannel& ch, const char* line);
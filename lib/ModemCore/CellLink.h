@@ -0,0 +1,31 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// The byte stream to the modem and the clock its timeouts run on. The
+// firmware drives it over the cellular UART; host tests drive it from the
+// simulated modem in test/sim. Baud rate and flow control stay with the
+// UART itself: a link only moves bytes.
+class CellLink {
+public:
+    virtual ~CellLink() {}
+    virtual int available() = 0;
+    virtual size_t read(uint8_t* buf, size_t len) = 0;
+    virtual size_t write(const uint8_t* buf, size_t len) = 0;
+    virtual void flush() = 0;  // Returns once everything written is on the wire
+    // Blocks until bytes are readable or timeout ms have passed since start
+    // (on millis()). Returns true if data is available.
+    virtual bool waitForData(uint32_t start, uint32_t timeout) = 0;
+    virtual uint32_t millis() = 0;
+
+    int read() {
+        uint8_t c;
+        return read(&c, 1) ? c : -1;
+    }
+    void print(const char* s) { write((const uint8_t*)s, strlen(s)); }
+    void println(const char* s) {
+        print(s);
+        print("\r\n");
+    }
+};
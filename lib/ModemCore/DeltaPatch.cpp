@@ -0,0 +1,138 @@
+#include "DeltaPatch.h"
+#include <stdio.h>
+#include <string.h>
+
+// Starts a patch against a base of baseSize bytes read through readBase,
+// cached windowCap bytes at a time in window.
+void deltaInit(DeltaPatcher& d, DeltaReadBase readBase, void* baseCtx, long baseSize, uint8_t* window, size_t windowCap) {
+    d.stage = DELTA_HEADER;
+    d.bufLen = 0;
+    d.produced = 0;
+    d.basePos = 0;
+    d.readBase = readBase;
+    d.baseCtx = baseCtx;
+    d.baseSize = baseSize;
+    d.window = window;
+    d.windowCap = windowCap;
+    d.windowStart = 0;
+    d.windowLen = 0;
+    d.error = NULL;
+}
+
+// True once the patch has produced exactly the target it announced.
+bool deltaComplete(const DeltaPatcher& d) {
+    return d.stage == DELTA_DONE && d.produced == d.targetSize;
+}
+
+// Name the patch for a base is published under: the lowercase hex SHA-256
+// of the whole base file, then ".patch" (what mkpatch.py writes by default).
+void deltaPatchName(const uint8_t baseSha[32], char* out, size_t cap) {
+    if (cap < DELTA_NAME_LEN) {
+        if (cap) out[0] = 0;
+        return;
+    }
+    for (int i = 0; i < 32; i++) snprintf(out + 2 * i, 3, "%02x", baseSha[i]);
+    strcpy(out + 64, ".patch");
+}
+
+// Makes base[pos] the first byte of the window; returns how many base bytes
+// from pos are cached (0 past the end or on read error).
+static size_t deltaBaseAt(DeltaPatcher& d, long pos) {
+    if (pos < 0 || pos >= d.baseSize) return 0;
+    if (pos < d.windowStart || pos >= d.windowStart + (long)d.windowLen) {
+        size_t len = d.windowCap < (size_t)(d.baseSize - pos) ? d.windowCap : (size_t)(d.baseSize - pos);
+        if (!d.readBase(d.baseCtx, pos, d.window, len)) return 0;
+        d.windowStart = pos;
+        d.windowLen = len;
+    }
+    return d.windowStart + d.windowLen - pos;
+}
+
+static uint32_t readLe32(const uint8_t* b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+// Consumes patch bytes and hands reconstructed image bytes to emit. Returns
+// false on a malformed patch (d.error says why) or sink failure.
+bool deltaFeed(DeltaPatcher& d, StreamEmit emit, void* ctx, const uint8_t* in, size_t len) {
+    uint8_t out[256];
+
+    while (len > 0) {
+        switch (d.stage) {
+            case DELTA_HEADER:
+                d.buf[d.bufLen++] = *in++;
+                len--;
+                if (d.bufLen < DELTA_HEADER_LEN) break;
+                if (readLe32(d.buf) != DELTA_MAGIC) {
+                    d.error = "Not a delta patch";
+                    return false;
+                }
+                d.targetSize = readLe32(d.buf + 4);
+                memcpy(d.targetSha, d.buf + 8, 32);
+                d.bufLen = 0;
+                d.stage = d.targetSize ? DELTA_CONTROL : DELTA_DONE;
+                break;
+
+            case DELTA_CONTROL:
+                d.buf[d.bufLen++] = *in++;
+                len--;
+                if (d.bufLen < 12) break;
+                d.diffLeft = readLe32(d.buf);
+                d.extraLeft = readLe32(d.buf + 4);
+                d.seek = (int32_t)readLe32(d.buf + 8);
+                d.bufLen = 0;
+                // Term by term against what is left, so huge lengths cannot wrap
+                if (d.diffLeft > d.targetSize - d.produced || d.extraLeft > d.targetSize - d.produced - d.diffLeft) {
+                    d.error = "Patch overruns target size";
+                    return false;
+                }
+                d.stage = d.diffLeft ? DELTA_DIFF : DELTA_EXTRA;
+                break;
+
+            case DELTA_DIFF: {
+                size_t n = len < d.diffLeft ? len : d.diffLeft;
+                if (n > sizeof(out)) n = sizeof(out);
+                size_t avail = deltaBaseAt(d, d.basePos);
+                if (avail == 0) {
+                    d.error = "Patch reads past the end of the base image";
+                    return false;
+                }
+                if (n > avail) n = avail;
+                const uint8_t* base = d.window + (d.basePos - d.windowStart);
+                for (size_t i = 0; i < n; i++) out[i] = base[i] + in[i];
+                if (!emit(ctx, out, n)) return false;
+                in += n;
+                len -= n;
+                d.basePos += n;
+                d.diffLeft -= n;
+                d.produced += n;
+                if (d.diffLeft == 0) d.stage = DELTA_EXTRA;
+                break;
+            }
+
+            case DELTA_EXTRA: {
+                size_t n = len < d.extraLeft ? len : d.extraLeft;
+                if (n && !emit(ctx, in, n)) return false;
+                in += n;
+                len -= n;
+                d.extraLeft -= n;
+                d.produced += n;
+                if (d.extraLeft == 0) {
+                    d.basePos += d.seek;
+                    d.stage = d.produced == d.targetSize ? DELTA_DONE : DELTA_CONTROL;
+                }
+                break;
+            }
+
+            case DELTA_DONE:
+                return true;
+        }
+    }
+
+    // A record with no extra bytes completes without further input
+    if (d.stage == DELTA_EXTRA && d.extraLeft == 0) {
+        d.basePos += d.seek;
+        d.stage = d.produced == d.targetSize ? DELTA_DONE : DELTA_CONTROL;
+    }
+    return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "StreamEmit.h"
+
+// Streaming binary patch, applied against the current image as it arrives.
+// bsdiff's control/diff/extra triples, laid out sequentially so no seeking
+// in the patch is needed (all integers little-endian):
+//   "DPT1"  u32 targetSize  u8[32] targetSha256
+//   repeat: u32 diffLen  u32 extraLen  i32 seek
+//           diffLen bytes   added bytewise to base[pos..], pos += diffLen
+//           extraLen bytes  copied as-is
+//           pos += seek
+// tools/mkpatch.py builds these and checks each one by applying it back.
+#define DELTA_MAGIC      0x31545044  // "DPT1"
+#define DELTA_HEADER_LEN 40
+#define DELTA_NAME_LEN   71          // 64 hex digits + ".patch" + NUL
+
+enum DeltaStage {
+    DELTA_HEADER, DELTA_CONTROL, DELTA_DIFF, DELTA_EXTRA, DELTA_DONE
+};
+
+// Reads len bytes of the base image at pos into out. False on error.
+typedef bool (*DeltaReadBase)(void* ctx, long pos, uint8_t* out, size_t len);
+
+struct DeltaPatcher {
+    DeltaStage stage;
+    uint8_t buf[DELTA_HEADER_LEN];  // Header / control bytes collected across chunks
+    size_t bufLen;
+    uint32_t targetSize;
+    uint8_t targetSha[32];
+    uint32_t produced;
+    uint32_t diffLeft;
+    uint32_t extraLeft;
+    int32_t seek;
+    long basePos;
+    // Base image: the stored file (SPIFFS) or the running app partition (OTA)
+    DeltaReadBase readBase;
+    void* baseCtx;
+    long baseSize;
+    uint8_t* window;      // Cached slice of the base
+    size_t windowCap;
+    long windowStart;
+    size_t windowLen;
+    const char* error;    // Why deltaFeed() failed, NULL if the sink did
+};
+
+void deltaInit(DeltaPatcher& d, DeltaReadBase readBase, void* baseCtx, long baseSize, uint8_t* window, size_t windowCap);
+bool deltaFeed(DeltaPatcher& d, StreamEmit emit, void* ctx, const uint8_t* in, size_t len);
+bool deltaComplete(const DeltaPatcher& d);
+void deltaPatchName(const uint8_t baseSha[32], char* out, size_t cap);
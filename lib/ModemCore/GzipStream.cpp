@@ -0,0 +1,142 @@
+#include "GzipStream.h"
+#if defined(ESP_PLATFORM)
+#include <esp_rom_crc.h>
+#endif
+
+// zlib's CRC-32, as the gzip trailer carries it
+static uint32_t gzipCrc32(uint32_t crc, const uint8_t* data, size_t len) {
+#if defined(ESP_PLATFORM)
+    return esp_rom_crc32_le(crc, data, len);
+#else
+    return (uint32_t)mz_crc32(crc, data, len);
+#endif
+}
+
+// Resets g for a new stream.
+void gzipInit(GzipInflater& g) {
+    tinfl_init(&g.inflator);
+    g.dictOfs = 0;
+    g.stage = GZ_HEADER;
+    g.flags = 0;
+    g.bufLen = 0;
+    g.skip = 0;
+    g.crc = 0;
+    g.outSize = 0;
+    g.error = NULL;
+}
+
+// True once the member trailer has been checked.
+bool gzipComplete(const GzipInflater& g) {
+    return g.stage == GZ_DONE;
+}
+
+// Advances past the optional gzip header fields that the flags announce.
+static GzipStage gzipNextHeaderStage(const GzipInflater& g, GzipStage from) {
+    if (from < GZ_EXTRA_LEN && (g.flags & GZ_FEXTRA)) return GZ_EXTRA_LEN;
+    if (from < GZ_NAME && (g.flags & GZ_FNAME)) return GZ_NAME;
+    if (from < GZ_COMMENT && (g.flags & GZ_FCOMMENT)) return GZ_COMMENT;
+    if (from < GZ_HCRC && (g.flags & GZ_FHCRC)) return GZ_HCRC;
+    return GZ_DEFLATE;
+}
+
+// Consumes one chunk of the gzip member, handing inflated output to emit.
+// Returns false on a corrupt stream (g.error says why) or sink failure.
+bool gzipFeed(GzipInflater& g, StreamEmit emit, void* ctx, const uint8_t* in, size_t len) {
+    while (len > 0) {
+        switch (g.stage) {
+            case GZ_HEADER:
+                g.buf[g.bufLen++] = *in++;
+                len--;
+                if (g.bufLen < 10) break;
+                // ID1 ID2 CM=8 (deflate)
+                if (g.buf[0] != 0x1f || g.buf[1] != 0x8b || g.buf[2] != 8) {
+                    g.error = "Not a gzip stream";
+                    return false;
+                }
+                g.flags = g.buf[3];
+                g.bufLen = 0;
+                g.stage = gzipNextHeaderStage(g, GZ_HEADER);
+                break;
+
+            case GZ_EXTRA_LEN:
+                g.buf[g.bufLen++] = *in++;
+                len--;
+                if (g.bufLen < 2) break;
+                g.skip = g.buf[0] | (g.buf[1] << 8);
+                g.bufLen = 0;
+                g.stage = g.skip ? GZ_EXTRA : gzipNextHeaderStage(g, GZ_EXTRA);
+                break;
+
+            case GZ_EXTRA: {
+                size_t n = len < g.skip ? len : g.skip;
+                in += n;
+                len -= n;
+                g.skip -= n;
+                if (g.skip == 0) g.stage = gzipNextHeaderStage(g, GZ_EXTRA);
+                break;
+            }
+
+            case GZ_NAME:
+            case GZ_COMMENT:
+                // Zero-terminated strings
+                len--;
+                if (*in++ == 0) g.stage = gzipNextHeaderStage(g, g.stage);
+                break;
+
+            case GZ_HCRC:
+                in++;
+                len--;
+                if (++g.bufLen == 2) {
+                    g.bufLen = 0;
+                    g.stage = GZ_DEFLATE;
+                }
+                break;
+
+            case GZ_DEFLATE: {
+                // Keep going while the window is full even if input ran out,
+                // or the tail of the image would wait for a chunk that never comes
+                tinfl_status st;
+                do {
+                    size_t inBytes = len;
+                    size_t outBytes = TINFL_LZ_DICT_SIZE - g.dictOfs;
+                    st = tinfl_decompress(&g.inflator, in, &inBytes, g.dict, g.dict + g.dictOfs,
+                                          &outBytes, TINFL_FLAG_HAS_MORE_INPUT);
+                    in += inBytes;
+                    len -= inBytes;
+                    if (outBytes) {
+                        g.crc = gzipCrc32(g.crc, g.dict + g.dictOfs, outBytes);
+                        g.outSize += outBytes;
+                        if (!emit(ctx, g.dict + g.dictOfs, outBytes)) return false;
+                        g.dictOfs = (g.dictOfs + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+                    }
+                } while (st == TINFL_STATUS_HAS_MORE_OUTPUT);
+
+                if (st < TINFL_STATUS_DONE) {
+                    g.error = "Inflate error";
+                    return false;
+                }
+                if (st == TINFL_STATUS_DONE) g.stage = GZ_TRAILER;
+                break;
+            }
+
+            case GZ_TRAILER: {
+                g.buf[g.bufLen++] = *in++;
+                len--;
+                if (g.bufLen < 8) break;
+                uint32_t crc = g.buf[0] | (g.buf[1] << 8) | (g.buf[2] << 16) | ((uint32_t)g.buf[3] << 24);
+                uint32_t isize = g.buf[4] | (g.buf[5] << 8) | (g.buf[6] << 16) | ((uint32_t)g.buf[7] << 24);
+                if (crc != g.crc || isize != g.outSize) {
+                    g.error = "gzip CRC/size mismatch";
+                    return false;
+                }
+                g.stage = GZ_DONE;
+                break;
+            }
+
+            case GZ_DONE:
+                // Trailing garbage (or a second member) is ignored
+                return true;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "StreamEmit.h"
+#if defined(ESP_PLATFORM)
+#include <esp32s3/rom/miniz.h>
+#else
+#include <miniz.h>
+#endif
+
+// Streaming gzip decoder on the ROM inflater. The 32 KB window is the output
+// ring itself, so the whole thing (~43 KB) sits in internal RAM.
+enum GzipStage {
+    GZ_HEADER, GZ_EXTRA_LEN, GZ_EXTRA, GZ_NAME, GZ_COMMENT, GZ_HCRC,
+    GZ_DEFLATE, GZ_TRAILER, GZ_DONE
+};
+
+#define GZ_FHCRC    0x02
+#define GZ_FEXTRA   0x04
+#define GZ_FNAME    0x08
+#define GZ_FCOMMENT 0x10
+
+struct GzipInflater {
+    tinfl_decompressor inflator;
+    uint8_t dict[TINFL_LZ_DICT_SIZE];
+    size_t dictOfs;
+    GzipStage stage;
+    uint8_t flags;
+    uint8_t buf[10];      // Header / trailer bytes collected across chunks
+    size_t bufLen;
+    size_t skip;          // FEXTRA bytes left to skip
+    uint32_t crc;
+    uint32_t outSize;
+    const char* error;    // Why gzipFeed() failed, NULL if the sink did
+};
+
+void gzipInit(GzipInflater& g);
+bool gzipFeed(GzipInflater& g, StreamEmit emit, void* ctx, const uint8_t* in, size_t len);
+bool gzipComplete(const GzipInflater& g);
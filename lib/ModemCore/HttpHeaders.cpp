@@ -0,0 +1,60 @@
+#include "HttpHeaders.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+void httpHeaderBegin(HttpHeaderParser& h) {
+    memset(&h, 0, sizeof(h));
+    h.contentLength = -1;
+    h.rangeTotal = -1;
+}
+
+// Consumes header bytes from data; returns how many were used. Once h.done
+// is set the rest of data is body.
+size_t httpHeaderFeed(HttpHeaderParser& h, const uint8_t* data, size_t len) {
+    size_t i = 0;
+    while (i < len && !h.done) {
+        char c = (char)data[i++];
+        if (++h.total > HTTP_HEADER_MAX) {
+            h.done = true;
+            h.status = 0;
+            break;
+        }
+        if (c == '\r') continue;
+        if (c != '\n') {
+            if (h.len < sizeof(h.line) - 1) h.line[h.len++] = c;
+            continue;
+        }
+        h.line[h.len] = 0;
+        if (h.len == 0) {
+            h.done = true;  // Blank line ends the header block
+            break;
+        }
+        h.len = 0;
+        if (!h.statusSeen) {
+            h.statusSeen = true;
+            sscanf(h.line, "HTTP/%*s %d", &h.status);
+            continue;
+        }
+        if (strncasecmp(h.line, "Content-Length:", 15) == 0) h.contentLength = atol(h.line + 15);
+        if (strncasecmp(h.line, "Content-Range:", 14) == 0) {
+            const char* slash = strchr(h.line, '/');
+            if (slash) h.rangeTotal = atol(slash + 1);
+        }
+        if (strncasecmp(h.line, "Accept-Ranges:", 14) == 0 && strstr(h.line + 14, "bytes")) h.acceptRanges = true;
+        copyHeaderValue(h.line, "ETag:", h.validators.etag, sizeof(h.validators.etag));
+        copyHeaderValue(h.line, "Last-Modified:", h.validators.lastModified, sizeof(h.validators.lastModified));
+    }
+    return i;
+}
+
+// Copies the value of header line (after "name:" and any spaces) into out.
+void copyHeaderValue(const char* line, const char* name, char* out, size_t outLen) {
+    size_t n = strlen(name);
+    if (strncasecmp(line, name, n) != 0) return;
+    const char* v = line + n;
+    while (*v == ' ') v++;
+    strncpy(out, v, outLen - 1);
+    out[outLen - 1] = 0;
+}
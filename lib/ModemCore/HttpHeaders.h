@@ -0,0 +1,33 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "AtChannel.h"
+
+#define HTTP_HEADER_MAX 8192  // Cap on the response header block we skip
+
+// Cache validators from the last complete download, kept in "<path>.meta" so
+// the next check can be a conditional GET
+#define VALIDATOR_MAX 96
+
+struct HttpValidators {
+    char etag[VALIDATOR_MAX];
+    char lastModified[VALIDATOR_MAX];
+};
+
+// Response header block parsed out of raw socket data, fed in arbitrary pieces
+struct HttpHeaderParser {
+    char line[AT_LINE_MAX];
+    size_t len;
+    size_t total;
+    bool statusSeen;
+    bool done;
+    int status;
+    long contentLength;   // -1 if absent
+    long rangeTotal;      // Size after '/' in Content-Range, -1 if absent
+    bool acceptRanges;
+    HttpValidators validators;
+};
+
+void httpHeaderBegin(HttpHeaderParser& h);
+size_t httpHeaderFeed(HttpHeaderParser& h, const uint8_t* data, size_t len);
+void copyHeaderValue(const char* line, const char* name, char* out, size_t outLen);
@@ -0,0 +1,96 @@
+#include "QHttp.h"
+#include <stdio.h>
+#include <string.h>
+
+void qhttpSessionReset(QHttpSession& s) {
+    s.requestHeaderMode = -1;
+    s.error = NULL;
+}
+
+bool qhttpGet(AtChannel& ch, QHttpSession& s, const char* url, const char* request, int& status, long& length) {
+    char cmd[40];
+    bool customHeader = request && *request;
+    status = 0;
+    length = -1;
+    s.error = NULL;
+
+    // Only re-send the header mode when it changed since the last request
+    int headerMode = customHeader ? 1 : 0;
+    if (headerMode != s.requestHeaderMode) {
+        if (!atSend(ch, customHeader ? "AT+QHTTPCFG=\"requestheader\",1" : "AT+QHTTPCFG=\"requestheader\",0", "OK", 1000)) {
+            s.error = "Request header mode not accepted";
+            return false;
+        }
+        s.requestHeaderMode = headerMode;
+    }
+
+    snprintf(cmd, sizeof(cmd), "AT+QHTTPURL=%u,80", (unsigned)strlen(url));
+    if (!atSend(ch, cmd, "CONNECT", 5000)) {
+        s.error = "URL CONNECT failed";
+        return false;
+    }
+    ch.link->print(url);
+    if (atWaitFor(ch, "OK", 5000, true) != AT_MATCH) {
+        s.error = "Modem rejected URL";
+        return false;
+    }
+
+    // The modem gets 80s to connect to the server and return the headers
+    if (customHeader) {
+        snprintf(cmd, sizeof(cmd), "AT+QHTTPGET=80,%u", (unsigned)strlen(request));
+        if (!atSend(ch, cmd, "CONNECT", 5000)) {
+            s.error = "GET header CONNECT failed";
+            return false;
+        }
+        ch.link->print(request);
+    } else {
+        ch.link->println("AT+QHTTPGET=80");
+    }
+
+    // +QHTTPGET: <err>,<status>[,<length>]
+    AtResult r = atWaitFor(ch, "+QHTTPGET: ", 80000, false);
+    if (r != AT_MATCH) {
+        s.error = r == AT_ERROR ? "HTTP GET rejected" : "No +QHTTPGET result";
+        return false;
+    }
+    int err = -1;
+    sscanf(ch.parser.line, "+QHTTPGET: %d,%d,%ld", &err, &status, &length);
+    if (err != 0) {
+        s.error = "HTTP GET failed";
+        return false;
+    }
+    return true;
+}
+
+bool qhttpReadBegin(AtChannel& ch, QHttpSession& s, unsigned waitS, HttpHeaderParser& h, uint32_t timeout) {
+    char cmd[24];
+    CellLink& link = *ch.link;
+    httpHeaderBegin(h);
+    s.error = NULL;
+
+    snprintf(cmd, sizeof(cmd), "AT+QHTTPREAD=%u", waitS);
+    link.println(cmd);
+    if (atWaitFor(ch, "CONNECT", 10000, true) != AT_MATCH) {
+        s.error = "No CONNECT for the response";
+        return false;
+    }
+
+    uint32_t start = link.millis();
+    while (!h.done) {
+        if (!link.waitForData(start, timeout)) {
+            s.error = "Response headers timed out";
+            return false;
+        }
+        uint8_t c = (uint8_t)link.read();
+        httpHeaderFeed(h, &c, 1);
+    }
+    if (h.status == 0) {
+        s.error = "Malformed response headers";
+        return false;
+    }
+    return true;
+}
+
+void qhttpReadEnd(AtChannel& ch) {
+    atWaitFor(ch, "+QHTTPREAD:", 1000, false);
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "AtChannel.h"
+#include "HttpHeaders.h"
+
+// The Quectel QHTTP request sequence, shared by the firmware and the host
+// tests so both drive the modem the same way.
+
+// What changes between requests of one QHTTP session
+struct QHttpSession {
+    int requestHeaderMode;   // Last "requestheader" value sent, -1 unknown
+    const char* error;       // Why the last call failed, NULL if it did not
+};
+
+void qhttpSessionReset(QHttpSession& s);
+
+// Sets the URL and issues AT+QHTTPGET, with request as the custom header
+// block when given. On success status/length hold the HTTP code and
+// Content-Length from +QHTTPGET.
+bool qhttpGet(AtChannel& ch, QHttpSession& s, const char* url, const char* request, int& status, long& length);
+
+// Issues AT+QHTTPREAD=<waitS> and parses the response header block that
+// "responseheader" mode puts ahead of the body, byte by byte so the first
+// body byte stays on the link.
+bool qhttpReadBegin(AtChannel& ch, QHttpSession& s, unsigned waitS, HttpHeaderParser& h, uint32_t timeout);
+
+// Consumes the +QHTTPREAD result that follows a fully read body
+void qhttpReadEnd(AtChannel& ch);
@@ -0,0 +1,38 @@
+#include "ResumePoint.h"
+#include <string.h>
+
+// FNV-1a over the URL minus its query, so the cache-busting ?t= is ignored.
+uint32_t urlKey(const char* url) {
+    const char* q = strchr(url, '?');
+    size_t n = q ? (size_t)(q - url) : strlen(url);
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (uint8_t)url[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void resumePointSet(ResumePoint& r, const char* url, long offset, long totalSize, const char* etag, uint32_t ctxSize) {
+    memset(&r, 0, sizeof(r));
+    strncpy(r.etag, etag, sizeof(r.etag) - 1);
+    r.magic = RESUME_MAGIC;
+    r.ctxSize = ctxSize;
+    r.urlHash = urlKey(url);
+    r.offset = offset;
+    r.totalSize = totalSize;
+}
+
+// True if r is a resume point for url written by this firmware, and the
+// partial file (partSize bytes, -1 if missing) is exactly what it covers.
+bool resumePointValid(const ResumePoint& r, const char* url, uint32_t ctxSize, long partSize) {
+    return r.magic == RESUME_MAGIC && r.ctxSize == ctxSize && r.urlHash == urlKey(url) &&
+           r.offset > 0 && r.offset < r.totalSize && partSize == r.offset;
+}
+
+// True if a response to "Range: bytes=<offset>-" carries the rest of the
+// image r describes. Anything else (a 200, or a 206 for a file that has
+// changed length) means starting over.
+bool resumeContinues(const ResumePoint& r, int status, long length) {
+    return status == 206 && r.offset + length == r.totalSize;
+}
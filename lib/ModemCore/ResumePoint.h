@@ -0,0 +1,23 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "HttpHeaders.h"
+
+// Where a cut-short download stopped, persisted in front of the digest
+// state. The digest context is only valid for the firmware that wrote it,
+// hence ctxSize.
+#define RESUME_MAGIC 0x52534d32  // "RSM2"
+
+struct ResumePoint {
+    uint32_t magic;
+    uint32_t ctxSize;     // sizeof() of the digest state saved with it
+    uint32_t urlHash;     // urlKey() of the download URL
+    long offset;          // Bytes already in the destination file
+    long totalSize;       // Full image size
+    char etag[VALIDATOR_MAX];  // Sent as If-Range so a changed file restarts
+};
+
+uint32_t urlKey(const char* url);
+void resumePointSet(ResumePoint& r, const char* url, long offset, long totalSize, const char* etag, uint32_t ctxSize);
+bool resumePointValid(const ResumePoint& r, const char* url, uint32_t ctxSize, long partSize);
+bool resumeContinues(const ResumePoint& r, int status, long length);
@@ -0,0 +1,17 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Portable FIPS 180-4 SHA-256 on the CPU. The firmware hashes through
+// mbedtls, which the ESP32-S3 port routes to the SHA engine with no software
+// fallback left in; this is the software side of hashBenchmark().
+struct Sha256Soft {
+    uint32_t state[8];
+    uint64_t total;       // Bytes hashed so far
+    uint8_t block[64];
+    size_t blockLen;
+};
+
+void sha256SoftInit(Sha256Soft& s);
+void sha256SoftUpdate(Sha256Soft& s, const uint8_t* data, size_t len);
+void sha256SoftFinish(Sha256Soft& s, uint8_t out[32]);
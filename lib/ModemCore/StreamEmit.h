@@ -0,0 +1,7 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Where a stream decoder (gzip, delta) hands its output. False aborts the
+// stream, e.g. when the storage write failed.
+typedef bool (*StreamEmit)(void* ctx, const uint8_t* data, size_t len);
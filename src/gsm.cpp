@@ -1,8 +1,37 @@
 
 #include <Arduino.h>
+#if STAGING_LITTLEFS
+#include <LittleFS.h>
+#define STAGING_FS      LittleFS
+#define STAGING_FS_NAME "LittleFS"
+#else
 #include <SPIFFS.h>
+#define STAGING_FS      SPIFFS
+#define STAGING_FS_NAME "SPIFFS"
+#endif
 #include <mbedtls/md5.h>
 #include <mbedtls/sha256.h>
+#include <mbedtls/pk.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <esp_ota_ops.h>
+#include <esp_image_format.h>
+#include <esp_heap_caps.h>
+#include <ArduinoJson.h>
+#include <WebServer.h>
+#include <esp_rom_crc.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include <CellLink.h>
+#include <AtChannel.h>
+#include <HttpHeaders.h>
+#include <QHttp.h>
+#include <ResumePoint.h>
+#include <GzipStream.h>
+#include <DeltaPatch.h>
+#include <Sha256Soft.h>
 
 // ============================================================================
 // CONFIGURATION
@@ -11,29 +40,560 @@
 #define PIN_CELL_RX      5
 #define PIN_CELL_PWRKEY  4
 #define PIN_CELL_RST     7
+#define PIN_CELL_RTS     -1       // ESP32 RTS -> modem RTS input, -1 = not wired
+#define PIN_CELL_CTS     -1       // ESP32 CTS <- modem CTS output, -1 = not wired
+#define CELL_RTS_THRESHOLD 100    // RX FIFO bytes at which we deassert RTS (max 127)
 #define UART_CELLULAR    2
-#define BAUD_CELLULAR    115200
+#define BAUD_CELLULAR    115200   // Modem power-on default
+#define BAUD_NEGOTIATE   true     // Try to move the data phase to a faster rate
+#define BAUD_PROBE_COUNT 10       // Consecutive ATs that must succeed at a new rate
+#define BAUD_MAX_NO_FLOW 460800   // Ceiling when RTS/CTS is not wired
 
-// URL with dynamic query param support
-const char* URL_BASE = "http://digitalpetro.s3.ap-south-1.amazonaws.com/BPCL/New+PCB+Bootcode/bootcode.bin";
+// Candidate rates for negotiation, fastest first
+static const uint32_t CELL_BAUD_RATES[] = { 921600, 460800, 230400 };
+
+// https:// URLs go through modem TLS context TLS_CTX_ID (see tlsConfigure())
+const char* URL_BASE = "https://digitalpetro.s3.ap-south-1.amazonaws.com/BPCL/New+PCB+Bootcode/bootcode.bin";
 const char* FILE_PATH = "/bootcode.bin";
-#define CHUNK_SIZE 4096  // Increased chunk size for better throughput
+const char* RESUME_PATH = "/bootcode.bin.resume";  // Offset + hash state of a partial download
+const char* MANIFEST_PATH = "/manifest.json";  // Last manifest fetched, validators in MANIFEST_PATH.meta
+const char* MANIFEST_URL = "https://digitalpetro.s3.ap-south-1.amazonaws.com/BPCL/New+PCB+Bootcode/manifest.json";
+const char* OTA_DIGEST_PATH = "/ota.sha256";        // SHA-256 of the last image written to the OTA slot
+// Release signing key (ECDSA P-256 public key, PEM). Images are signed over
+// their SHA-256. Empty: signing is off. Set: every image must carry a valid
+// signature or it is rejected.
+const char* SIGNING_PUBLIC_KEY = "";
+// CA that signs the download server's chain (PEM). Empty: https:// is refused
+// unless TLS_ALLOW_UNVERIFIED is set. Amazon Root CA 1 (valid to 2038) roots
+// the S3 chain behind URL_BASE, MANIFEST_URL and DELTA_URL_BASE.
+const char* TLS_CA_CERT =
+    "-----BEGIN CERTIFICATE-----\n"
+    "MIIDQTCCAimgAwIBAgITBmyfz5m/jAo54vB4ikPmljZbyjANBgkqhkiG9w0BAQsF\n"
+    "ADA5MQswCQYDVQQGEwJVUzEPMA0GA1UEChMGQW1hem9uMRkwFwYDVQQDExBBbWF6\n"
+    "b24gUm9vdCBDQSAxMB4XDTE1MDUyNjAwMDAwMFoXDTM4MDExNzAwMDAwMFowOTEL\n"
+    "MAkGA1UEBhMCVVMxDzANBgNVBAoTBkFtYXpvbjEZMBcGA1UEAxMQQW1hem9uIFJv\n"
+    "b3QgQ0EgMTCCASIwDQYJKoZIhvcNAQEBBQADggEPADCCAQoCggEBALJ4gHHKeNXj\n"
+    "ca9HgFB0fW7Y14h29Jlo91ghYPl0hAEvrAIthtOgQ3pOsqTQNroBvo3bSMgHFzZM\n"
+    "9O6II8c+6zf1tRn4SWiw3te5djgdYZ6k/oI2peVKVuRF4fn9tBb6dNqcmzU5L/qw\n"
+    "IFAGbHrQgLKm+a/sRxmPUDgH3KKHOVj4utWp+UhnMJbulHheb4mjUcAwhmahRWa6\n"
+    "VOujw5H5SNz/0egwLX0tdHA114gk957EWW67c4cX8jJGKLhD+rcdqsq08p8kDi1L\n"
+    "93FcXmn/6pUCyziKrlA4b9v7LWIbxcceVOF34GfID5yHI9Y/QCB/IIDEgEw+OyQm\n"
+    "jgSubJrIqg0CAwEAAaNCMEAwDwYDVR0TAQH/BAUwAwEB/zAOBgNVHQ8BAf8EBAMC\n"
+    "AYYwHQYDVR0OBBYEFIQYzIU07LwMlJQuCFmcx7IQTgoIMA0GCSqGSIb3DQEBCwUA\n"
+    "A4IBAQCY8jdaQZChGsV2USggNiMOruYou6r4lK5IpDB/G/wkjUu0yKGX9rbxenDI\n"
+    "U5PMCCjjmCXPI6T53iHTfIUJrU6adTrCC2qJeHZERxhlbI1Bjjt/msv0tadQ1wUs\n"
+    "N+gDS63pYaACbvXy8MWy7Vu33PqUXHeeE6V/Uq2V8viTO96LXFvKWlJbYK8U90vv\n"
+    "o/ufQJVtMVT8QtPHRh8jrdkPSHCa2XV4cdFyQzR1bldZwgJcJmApzyMZFo6IQ6XU\n"
+    "5MsI+yMRQ+hDKXJioaldXgjUkK642M4UwtBV8ob2xJNDd2ZhwLnoQdeXeGADbkpy\n"
+    "rqXRfboQnoZsG4q5WTP468SQvvG5\n"
+    "-----END CERTIFICATE-----\n";
+const char* TELEMETRY_PATH = "/telemetry.jsonl";  // One JSON report per line, newest last
+const char* TLS_CA_CRC_PATH = "/ca.crc";  // CRC32 of the CA last uploaded to the modem
+const char* PROFILES_PATH = "/profiles.json";     // Carrier profiles, same format as DEFAULT_PROFILES
+const char* PROFILE_LAST_PATH = "/profile.last";  // "<IMSI> <profile name>" of the last successful attach
+// Used when PROFILES_PATH is absent. "plmn" lists MCC+MNC prefixes of the
+// IMSIs a profile serves; a profile without any is the fallback. Top-level
+// and per-profile "url" / "manifest_url" override URL_BASE / MANIFEST_URL.
+const char* DEFAULT_PROFILES =
+    "{\"profiles\":["
+    "{\"name\":\"airtel\",\"apn\":\"airtelgprs.com\",\"plmn\":[\"40402\",\"40403\",\"40410\",\"40440\",\"40445\",\"40449\",\"40490\",\"40492\",\"40493\",\"40494\",\"40495\",\"40496\",\"40497\",\"40498\"]},"
+    "{\"name\":\"jio\",\"apn\":\"jionet\",\"plmn\":[\"405840\",\"405854\",\"405855\",\"405856\",\"405857\",\"405858\",\"405859\",\"405860\",\"405861\",\"405862\",\"405863\",\"405864\",\"405865\",\"405866\",\"405867\",\"405868\"]},"
+    "{\"name\":\"vi\",\"apn\":\"www\",\"plmn\":[\"40401\",\"40405\",\"40411\",\"40413\",\"40415\",\"40420\",\"40427\",\"40430\",\"40443\",\"40446\",\"40460\",\"40484\",\"40486\",\"40488\"]},"
+    "{\"name\":\"bsnl\",\"apn\":\"bsnlnet\",\"plmn\":[\"40434\",\"40438\",\"40451\",\"40453\",\"40454\",\"40455\",\"40457\",\"40458\",\"40459\",\"40462\",\"40464\",\"40466\",\"40471\",\"40472\",\"40473\",\"40474\"]},"
+    "{\"name\":\"fallback\",\"apn\":\"airtelgprs.com\"}"
+    "]}";
+const char* DELTA_URL_BASE = "https://digitalpetro.s3.ap-south-1.amazonaws.com/BPCL/New+PCB+Bootcode/patches/";
+#define CHUNK_SIZE 4096  // Flash sector / internal bounce buffer size
+#define DOWNLOAD_SINK SINK_FILE    // SINK_OTA: inactive app slot, SINK_RAW: RAW_PARTITION_LABEL
+#define RAW_PARTITION_LABEL "staging"  // Data partition used by SINK_RAW
+#define RAW_ERASE_AHEAD   (64 * 1024)  // SINK_RAW erases up to this far past the write cursor while the writer is idle
+const char* RAW_INFO_PATH = "/staging.info";  // Size + SHA-256 of the image in RAW_PARTITION_LABEL
+#define DOWNLOAD_HASH HASH_SHA256  // Digest computed inline while receiving (SHA-256 runs on the
+                                   // S3 SHA engine; MD5 has no engine and stays in software)
+#define SIG_SUFFIX ".sig"          // DER ECDSA signature of the image's SHA-256, next to the image
+#define SIG_MAX_LEN 80             // P-256 DER signatures are at most 72 bytes
+#define TLS_CTX_ID 1               // Modem SSL context shared by QHTTP and QSSLOPEN sockets
+#define TLS_CA_FILE "UFS:ca.pem"   // Where TLS_CA_CERT is uploaded on the modem
+#define TLS_ALLOW_UNVERIFIED false // With no TLS_CA_CERT, encrypt without authenticating the server
+#define TELEMETRY_MAX_BYTES (16 * 1024)  // Rotate TELEMETRY_PATH past this size
+#define HASH_BENCHMARK false       // Report SHA-256 MB/s, engine vs software, per buffer at startup
+#define HASH_BENCH_BYTES (1024 * 1024)
+#define EXPECTED_DIGEST ""         // Hex digest to enforce; empty = print only
+#define VERIFY_READBACK false      // Paranoid mode: re-read the stored image and re-hash
+#define DOWNLOAD_RESUME true       // Keep partial SPIFFS downloads and continue with a Range GET
+#define DOWNLOAD_GZIP false        // URL serves a gzip'd image; inflate on the fly before the sink
+#define DOWNLOAD_DELTA false       // Try DELTA_URL_BASE/<base sha256>.patch before the full image
+#define DELTA_PATCH_GZIP true      // Patches are served gzip'd
+#define DOWNLOAD_ATTEMPTS 3
+#define DOWNLOAD_MANIFEST false    // Fetch MANIFEST_URL and download every entry it lists
+#define MANIFEST_MAX_SIZE 4096     // Largest manifest body we accept
+#define MANIFEST_MAX_ENTRIES 8
+#define PROFILE_MAX       6        // Carrier profiles kept from PROFILES_PATH
+#define PROFILE_PLMN_MAX  16
+#define DOWNLOAD_SEGMENTS 0        // >1: fetch that many byte ranges in parallel over raw sockets
+#define SEGMENT_MIN_SIZE  (64 * 1024)  // Smaller images are not worth splitting
+#define TCP_FIRST_ID      1        // connectIDs TCP_FIRST_ID.. are ours (QHTTP keeps its own)
+#define TCP_READ_MAX      1500     // Largest AT+QIRD the modem serves in one go
+#define DOWNLOAD_TRANSPORT TRANSPORT_QHTTP  // TRANSPORT_TCP: own HTTP over a socket, AT+QIRD pull reads
+#define TCP_DATA_ID       TCP_FIRST_ID
+#define TCP_STATUS_INTERVAL 10000  // Signal report between reads on the socket transport, 0 = off
+#define UFS_FILE          "UFS:dl.bin"  // TRANSPORT_UFS staging file on the modem
+#define UFS_READ_MAX      16384    // Bytes per AT+QFREAD block
+#define UFS_READ_RETRIES  3        // Re-reads of a block whose framing is wrong
+#define UFS_FETCH_TIMEOUT 1800     // Seconds the modem may take to store the body
+
+// Download pipeline: UART reader and storage writer run on opposite cores
+// so a slow SPIFFS page program never stops us draining the modem.
+#define PIPELINE_CHUNKS       4     // Chunk buffers shared between the tasks
+#define POOL_CHUNK_SIZE       (32 * 1024)  // Per-chunk size when PSRAM is present
+#define CELL_RX_BUFFER        (16 * 1024)  // UART driver ring (always internal RAM)
+#define PIPELINE_READER_CORE  1
+#define PIPELINE_WRITER_CORE  0
+#define PIPELINE_STACK        4096
+#define PIPELINE_FLUSH_MS     20    // Hand over a partial chunk after this gap
+#define INACTIVITY_TIMEOUT    60000
+#define ADAPTIVE_CHUNKS       true  // Size reader batches from measured link rate and write cost
+#define ADAPT_BATCH_MS        250   // Link time one batch should cover
+#define ADAPT_FLUSH_MAX_MS    300   // Longest gap a slow link may leave a partial batch waiting
+#define ADAPT_WRITER_BUSY     0.5f  // Writer duty cycle above which batches go to the maximum
+
+// gsm_begin(): the whole flow runs in its own task while loop() keeps going
+#define DOWNLOADER_CORE       1     // Shares the loop() core, time-sliced at equal priority
+#define DOWNLOADER_PRIORITY   1
+#define DOWNLOADER_STACK      8192
+#define SHARE_RETRY_AFTER     30    // Seconds a local client is told to wait mid-download
+
+// Scheduled checks: after a run the modem sleeps and the S3 deep sleeps; the
+// next boot repeats the conditional GET, which is a 304 when nothing changed.
+#define UPDATE_CHECK_INTERVAL 3600  // Seconds between checks, 0 = stay awake after the run
+#define UPDATE_RETRY_INTERVAL 600   // Used instead after a failed run
+#define AWAKE_WINDOW_MS       30000 // Keep serving local clients this long before sleeping
+#define MODEM_SLEEP           MODEM_SLEEP_OFF  // MODEM_SLEEP_PSM: keep the attach across sleeps
+#define PSM_PERIODIC_TAU      "00100001"  // T3412 requested with AT+CPSMS: 1 h
+#define PSM_ACTIVE_TIME       "00000101"  // T3324: 10 s reachable after each TAU
+
+#define AT_BENCHMARK      false    // Report AT line / HTTP header parser cost at startup
 
 HardwareSerial CellUART(UART_CELLULAR);
 
+// Given from the UART driver's event task whenever bytes land in the RX ring
+// buffer, so waiters block instead of spinning on cellLink.available().
+static SemaphoreHandle_t cellRxSignal = NULL;
+static uint32_t cellBaud = BAUD_CELLULAR;  // Rate both ends currently agree on
+static bool cellFlowControl = false;       // RTS/CTS active on both ends
+static size_t cellRxRing = 0;              // UART driver RX ring size in use
+static char pdpAddress[48] = "";           // IP of PDP context 1 while it is up
+static bool httpSessionReady = false;      // One-time QHTTPCFG done since power-up
+static bool httpSessionTls = false;        // sslctxid set for this HTTP session
+static QHttpSession qhttp = { -1, NULL };  // Request header mode the modem holds
+static bool tlsReady = false;              // QSSLCFG for TLS_CTX_ID done since power-up
+static int lastHttpStatus = 0;             // Status of the most recent +QHTTPGET
+#define CELL_RX_TIMEOUT_SYMBOLS 2  // Idle symbols before the driver reports a burst
+
+bool cellWaitForData(uint32_t start, uint32_t timeout);
+
+// CellLink over the UART driver. Waiters block on cellRxSignal.
+class UartCellLink : public CellLink {
+public:
+    using CellLink::read;
+    int available() override { return CellUART.available(); }
+    size_t read(uint8_t* buf, size_t len) override { return CellUART.read(buf, len); }
+    size_t write(const uint8_t* buf, size_t len) override { return CellUART.write(buf, len); }
+    void flush() override { CellUART.flush(); }
+    bool waitForData(uint32_t start, uint32_t timeout) override { return cellWaitForData(start, timeout); }
+    uint32_t millis() override { return ::millis(); }
+};
+
+static UartCellLink cellLink;
+static AtChannel atChannel = { &cellLink, {}, {} };
+
+// What the modem does while we deep sleep between scheduled checks
+enum ModemSleep {
+    MODEM_SLEEP_OFF,      // AT+QPOWD graceful power-down (PWRKEY if it does not answer)
+    MODEM_SLEEP_PSM       // 3GPP power saving mode; stays registered, wakes on PWRKEY
+};
+
+// Survive deep sleep
+RTC_DATA_ATTR static uint32_t scheduledChecks = 0;
+RTC_DATA_ATTR static bool modemInPsm = false;
+
+// APN and download URLs for one carrier (see DEFAULT_PROFILES)
+struct CarrierProfile {
+    char name[16];
+    char plmn[PROFILE_PLMN_MAX][7];  // MCC+MNC prefixes, none = fallback
+    int plmnCount;
+    char apn[64];
+    char user[32];
+    char pass[32];
+    int auth;                 // AT+QICSGP <authentication>: 0 none, 1 PAP, 2 CHAP
+    char url[256];            // Empty: top-level "url", then URL_BASE
+    char manifestUrl[256];
+};
+
+static CarrierProfile profiles[PROFILE_MAX];
+static int profileCount = 0;
+static int activeProfile = -1;        // Index into profiles, -1 until selectProfile()
+static bool profileMatched = false;   // Chosen by IMSI (or cache), not by elimination
+static char simImsi[16] = "";
+static char defaultUrl[256] = "";     // Top-level overrides from PROFILES_PATH
+static char defaultManifestUrl[256] = "";
+
+// Where downloadAndVerify() puts the body
+enum DownloadSink {
+    SINK_FILE,     // Stage in a file on the staging filesystem (FILE_PATH by default)
+    SINK_OTA,      // Stream straight into the inactive app partition
+    SINK_RAW       // Sector-aligned writes into a raw data partition, erased ahead
+};
+
+// How the single-stream GET reaches us
+enum HttpTransport {
+    TRANSPORT_QHTTP,  // Modem HTTP stack; AT+QHTTPREAD pushes the body in CONNECT mode
+    TRANSPORT_TCP,    // Our own request on a socket; we pull the body with AT+QIRD
+    TRANSPORT_UFS     // Modem stores the body in its UFS first; we burst it with AT+QFREAD
+};
+
+struct StorageSink {
+    DownloadSink kind;
+    const char* path;
+    File file;
+    const esp_partition_t* partition;
+    esp_ota_handle_t ota;
+    // SINK_RAW: bytes are gathered into one sector so every flash write is a
+    // whole, already-erased CHUNK_SIZE block
+    long written;         // Bytes committed to the partition
+    long erasedTo;        // Partition offset erased up to
+    size_t blockLen;      // Bytes waiting in bufferPool.sector
+};
+
+enum HashAlgo {
+    HASH_MD5,
+    HASH_SHA256
+};
+
+#define HASH_MAX_LEN 32
+
+// Incremental digest fed one chunk at a time as data arrives
+struct StreamHash {
+    HashAlgo algo;
+    mbedtls_md5_context md5;
+    mbedtls_sha256_context sha256;
+};
+
+struct DownloadOptions {
+    DownloadSink sink;
+    const char* path;             // SPIFFS destination for SINK_FILE
+    HashAlgo hash;
+    const char* expectedDigest;   // Hex, NULL/empty to skip the comparison
+    bool verifyReadback;          // Re-read the stored image after download
+    bool resume;                  // Continue a partial SPIFFS download (Range GET)
+    bool gzip;                    // Body is gzip; sink and digest see the inflated image
+    bool delta;                   // Body is a patch against what is stored/running now
+    const uint8_t* signature;     // DER signature over the final SHA-256, NULL for none
+    size_t signatureLen;
+    const char* signedUrl;        // Without signature: fetch signedUrl + SIG_SUFFIX once the body is in
+};
+
+static GzipInflater* gzipInflater = NULL;
+static DeltaPatcher deltaPatcher;
+// Base image the patch reads: the stored file (SPIFFS) or the running app partition (OTA)
+static File deltaBaseFile;
+static const esp_partition_t* deltaBasePart = NULL;
+
+// Persisted in RESUME_PATH when a SPIFFS download is cut short
+struct ResumeState {
+    ResumePoint point;
+    StreamHash hash;      // Digest state covering [0, point.offset)
+};
+
+// One artefact listed in the manifest:
+// { "files": [ { "url": "...", "path": "/app.bin", "size": 123, "sha256": "...", "sink": "file", "gzip": false } ] }
+// "sink" is "file" (default; "spiffs" still accepted), "ota" or "raw". An
+// optional "sig" holds the hex DER signature of the SHA-256.
+struct ManifestEntry {
+    char url[256];
+    char path[32];        // SPIFFS object names are limited to 32 bytes
+    long size;
+    char sha256[65];      // Of the stored (inflated) image
+    uint8_t sig[SIG_MAX_LEN];  // Optional "sig": hex DER signature of that SHA-256
+    size_t sigLen;
+    DownloadSink sink;
+    bool gzip;
+};
+
+// One byte range [start, end] of a segmented download on its own socket
+#define SEGMENT_MAX 6
+
+struct DownloadSegment {
+    int id;               // Modem connectID
+    long start;
+    long end;             // Inclusive
+    long pos;             // Next byte offset expected
+    HttpHeaderParser hdr;
+    StorageSink part;     // SPIFFS: "<path>.<n>" staging file
+    char partPath[32];
+    bool done;
+};
+
+static volatile uint32_t tcpClosedMask = 0;  // connectIDs the peer has closed
+static uint32_t tcpTlsMask = 0;              // connectIDs opened with AT+QSSLOPEN
+
+// Body bytes that arrived in the same socket/UFS read as the end of the headers
+static uint8_t bodyPending[TCP_READ_MAX];
+static size_t bodyPendingLen = 0;
+
+// Where the time of one download run went, for comparing firmware versions
+// and operators across the fleet. Reset in gsm_setup(), reported at the end
+// of startDownload().
+enum TelemetryPhase {
+    TM_POWER_CYCLE, TM_SIM, TM_PDP, TM_HTTP_GET, TM_CONNECT_WAIT,
+    TM_TRANSFER, TM_FLASH_WRITE, TM_WRITE_STALL, TM_VERIFY, TM_PHASES
+};
+
+static const char* const TM_PHASE_NAMES[TM_PHASES] = {
+    "power_cycle", "sim", "pdp", "http_get", "connect_wait",
+    "transfer", "flash_write", "write_stall", "verify"
+};
+
+struct Telemetry {
+    uint32_t phaseMs[TM_PHASES];
+    long bytes;           // Body bytes received over all attempts
+    int maxRxFill;        // Peak UART ring occupancy seen by the reader
+    int retries;          // Failed download attempts
+    int baudDowngrades;
+    char op[32];          // Operator from AT+COPS?
+};
+
+static Telemetry telemetry = {};
+
+// Background downloader (gsm_begin / gsm_poll). The task writes, loop() and
+// the web handlers read a copy under downloaderLock; callbacks only ever run
+// from gsm_poll().
+enum DownloaderState {
+    DL_IDLE, DL_CONNECTING, DL_DOWNLOADING, DL_VERIFYING, DL_DONE, DL_FAILED
+};
+
+static const char* const DL_STATE_NAMES[] = {
+    "idle", "connecting", "downloading", "verifying", "done", "failed"
+};
+
+struct DownloaderStatus {
+    DownloaderState state;
+    long received;        // Body bytes of the current transfer stored so far
+    long total;           // Its size, 0 until the GET answers
+    uint32_t startedMs;
+    uint32_t finishedMs;
+    uint32_t run;         // Bumped by every gsm_begin(), so gsm_poll() tells runs apart
+    // Task-private counters as of the last state change or progress report
+    int httpStatus;       // lastHttpStatus
+    int retries;          // telemetry.retries
+    long bytes;           // telemetry.bytes
+    uint32_t transferMs;  // telemetry.phaseMs[TM_TRANSFER]
+    uint32_t baud;        // cellBaud
+};
+
+typedef void (*DownloadDoneCallback)(bool success);
+typedef void (*DownloadStateCallback)(const char* state);  // DL_STATE_NAMES entry
+
+static DownloaderStatus downloader = {};
+static portMUX_TYPE downloaderLock = portMUX_INITIALIZER_UNLOCKED;
+static DownloadDoneCallback downloaderOnDone = NULL;
+static DownloadStateCallback downloaderOnState = NULL;
+
+// Preallocated once and reused by every download and verification, so a
+// fragmented heap can never make a transfer fail on malloc. Chunks live in
+// PSRAM when available (internal RAM at CHUNK_SIZE otherwise); bounce is a
+// small internal DMA-capable buffer for consumers that cannot take PSRAM.
+struct BufferPool {
+    uint8_t* chunks[PIPELINE_CHUNKS];
+    size_t chunkSize;
+    uint8_t* bounce;
+    uint8_t* sector;      // SINK_RAW write-combining block (internal, CHUNK_SIZE)
+    bool psram;
+    bool ready;
+};
+
+static BufferPool bufferPool = {};
+
+struct PipelineChunk {
+    uint8_t* data;
+    size_t len;
+};
+
+struct DownloadPipeline {
+    QueueHandle_t freeQueue;   // Chunk indices ready to be filled by the reader
+    QueueHandle_t fullQueue;   // Chunk indices ready to be written by the writer
+    PipelineChunk chunks[PIPELINE_CHUNKS];
+    StorageSink* sink;
+    StreamHash* hash;
+    GzipInflater* inflater;    // NULL: chunks go to the sink as received
+    DeltaPatcher* patcher;     // NULL: (inflated) bytes are the image itself
+    HttpTransport transport;   // Where the reader gets body bytes from
+    int handle;                // Socket connectID / UFS file handle
+    long fileSize;        // Bytes expected in this transfer
+    long baseOffset;      // Bytes already stored before it (resume)
+    long totalSize;       // Full image size, for progress
+    volatile long bytesRead;
+    volatile long bytesWritten;   // Wire bytes consumed by the writer
+    volatile long outputBytes;    // Bytes handed to the sink (after inflate)
+    uint32_t hashUs;              // Writer time spent in hashUpdate()
+    uint32_t writeUs;             // Writer time spent in sinkWrite()
+    uint32_t stallMs;             // Reader time waiting for a free chunk
+    volatile bool timedOut;
+    volatile bool writeFailed;
+    TaskHandle_t owner;
+};
+
+static const uint8_t PIPELINE_END = 0xFF;  // Sentinel pushed after the last chunk
+
+// Picks the reader's batch size and partial-batch flush gap. Measurements
+// carry over between transfers of one boot, so retries start tuned. A 2G
+// link gets whole sectors with a long flush gap (instead of many tiny
+// writes); LTE gets big batches, and a writer that cannot keep up gets the
+// full chunk so each write's fixed cost is paid less often.
+struct ChunkController {
+    float rate;                     // Arrival rate EWMA, bytes/s, 0 = no sample yet
+    volatile float writeUsPerByte;  // Writer cost EWMA (sink + hash + decode)
+    size_t target;                  // Batch size, multiple of CHUNK_SIZE
+    uint32_t flushMs;
+    size_t minTarget;
+    size_t maxTarget;
+    uint32_t changes;
+    uint32_t maxWriteUs;            // Longest single batch write seen
+};
+
+static ChunkController chunkCtl = {};
+
 // ============================================================================
 // FORWARD DECLARATIONS
 // ============================================================================
 bool gsm_setup();
 bool system_init(); // New function to handle SPIFFS init
 void startDownload();
-void downloadAndVerify(const String& url);
-void calculateStorageChecksum();
-bool sendAT(String cmd, const char* expected, uint32_t timeout);
-String waitForResponse(uint32_t timeout);
+bool startImageDownload();
+bool startManifestDownload();
+void telemetryReset();
+bool gsm_begin(DownloadDoneCallback onDone, DownloadStateCallback onState);
+bool gsm_poll();
+DownloaderStatus gsm_status();
+void downloaderTask(void* arg);
+void downloaderEnter(DownloaderState state);
+void downloaderProgress(long received, long total);
+void gsm_register_web(WebServer& server);
+void gsm_idle_sleep();
+bool loadProfiles();
+int parseProfiles(const char* json, size_t len);
+int selectProfile();
+bool readImsi(char* out, size_t outLen);
+void saveLastProfile();
+const char* imageUrl();
+const char* manifestUrl();
+void sleepUntilNextCheck(bool lastRunOk);
+bool modemPowerDown();
+bool modemEnterPsm();
+bool modemWakeFromPsm();
+void modemPwrkeyPulse(uint32_t ms);
+void handleImageRequest(WebServer& server);
+void handleProgressRequest(WebServer& server);
+bool parseByteRange(const String& header, long size, long& from, long& to);
+void parserBenchmark();
+void telemetryAdd(TelemetryPhase phase, uint32_t ms);
+void telemetryReport(bool success);
+DownloadOptions defaultDownloadOptions();
+bool downloadWithRetries(const String& url, const DownloadOptions& opts);
+bool downloadAndVerify(const String& url, const DownloadOptions& opts);
+bool finishDownload(StorageSink& sink, const DownloadOptions& opts, const uint8_t* digest, long imageSize,
+                    const char* storedPath, const uint8_t* patchTargetSha, const HttpValidators& validators);
+bool calculateStorageChecksum(const char* path, HashAlgo algo, const uint8_t* expected);
+bool storedFileDigest(const char* path, HashAlgo algo, uint8_t* out);
+bool calculatePartitionChecksum(const esp_partition_t* part, size_t size, HashAlgo algo, const uint8_t* expected);
+void hashBegin(StreamHash& h, HashAlgo algo);
+void hashUpdate(StreamHash& h, const uint8_t* data, size_t len);
+size_t hashFinish(StreamHash& h, uint8_t* out);
+void printDigest(HashAlgo algo, const uint8_t* digest, size_t len);
+void hashBenchmark();
+bool digestMatchesHex(const uint8_t* digest, size_t len, const char* hex);
+bool signatureAccepted(const DownloadOptions& opts, HashAlgo algo, const uint8_t* digest);
+size_t fetchSignature(const String& imageUrl, uint8_t* out, size_t cap);
+size_t hexToBytes(const char* hex, uint8_t* out, size_t cap);
+bool sinkBegin(StorageSink& sink, DownloadSink kind, const char* path, long size, long resumeOffset);
+bool sinkWrite(StorageSink& sink, const uint8_t* data, size_t len);
+bool sinkEnd(StorageSink& sink, bool success);
+bool rawEraseTo(StorageSink& sink, long end);
+bool rawFlushBlock(StorageSink& sink);
+bool rawEraseAhead(StorageSink& sink);
+void saveRawInfo(long size, const uint8_t* digest);
+void sinkSuspend(StorageSink& sink);
+bool httpSessionOpen(bool tls);
+bool httpGet(const String& url, const String& extraHeaders, int& status, long& length);
+long httpFetchToBuffer(const String& url, char* buf, size_t cap, const String& extraHeaders = "", HttpValidators* validators = NULL);
+int parseManifest(const char* json, size_t len, ManifestEntry* entries, int maxEntries);
+bool manifestEntryCurrent(const ManifestEntry& e);
+void saveOtaDigest(const uint8_t* digest);
+bool splitUrl(const String& url, String& host, String& path);
+bool loadResumeState(ResumeState& state, const String& url, const char* path, HashAlgo algo);
+void saveResumeState(const String& url, long offset, long totalSize, const char* etag, const StreamHash& hash);
+bool loadValidators(const char* path, HttpValidators& v);
+void saveValidators(const char* path, const HttpValidators& v);
+void clearResumeState();
+void drainModem(uint32_t quietMs, uint32_t maxMs);
+void onCellReceive();
+bool cellWaitForData(uint32_t start, uint32_t timeout);
+bool sendAT(const char* cmd, const char* expected, uint32_t timeout);
+bool waitForResponse(const char* token, uint32_t timeout);
+AtResult atWaitFor(const char* expected, uint32_t timeout, bool stopOnOk);
+bool atOnUrc(const char* prefix, AtUrcHandler handler);
+void atDispatchUrc(const char* line);
 void powerCycleModem();
 bool connectNetwork();
+bool modemAlive();
+bool networkReady();
+bool pdpContextActive();
+bool atQuery(const char* cmd, const char* prefix, char* out, size_t outLen, uint32_t timeout);
+bool enableFlowControl();
+bool negotiateBaudRate(uint32_t maxBaud);
+bool switchBaudRate(uint32_t baud);
+bool probeLink(int count);
+void lowerBaudRate();
 void printProgress(size_t current, size_t total);
+long runDownloadPipeline(StorageSink& sink, StreamHash& hash, GzipInflater* inflater, DeltaPatcher* patcher, HttpTransport transport, int handle, long fileSize, long baseOffset, long* outputBytes);
+size_t pipelineFillFromSocket(DownloadPipeline* p, PipelineChunk& c, size_t want);
+size_t pipelineFillFromUfs(DownloadPipeline* p, PipelineChunk& c, size_t want);
+size_t takeBodyPending(uint8_t* out, size_t want);
+bool ufsHasRoom(long size);
+bool ufsStoreBody();
+int ufsOpenBody(HttpValidators& v);
+int ufsRead(int fh, uint8_t* buf, size_t len);
+void ufsClose(int fh);
+bool tcpHttpGet(const String& url, const String& extraHeaders, int id, int& status, long& length, HttpValidators& v);
+bool pipelineEmit(void* ctx, const uint8_t* data, size_t len);
+bool pipelineStore(void* ctx, const uint8_t* data, size_t len);
+bool deltaBaseDigest(DownloadSink sink, const char* path, uint8_t* out);
+long appImageLength(const esp_partition_t* part);
+DeltaPatcher* deltaBegin(DownloadSink sink, const char* basePath);
+void deltaEnd(DeltaPatcher& d);
+bool bufferPoolInit();
+GzipInflater* gzipBegin();
+void pipelineReaderTask(void* arg);
+void pipelineWriterTask(void* arg);
+size_t adaptBatch(DownloadPipeline* p);
+void adaptObserve(size_t len, uint32_t fillUs);
+void adaptWriteCost(size_t len, uint32_t us);
+bool segmentedDownload(const String& url, const DownloadOptions& opts);
+bool httpHead(const String& url, HttpHeaderParser& head);
+void refreshValidators(const String& url, const char* path);
+bool splitHostPort(const String& hostPort, String& host, uint16_t& port, uint16_t defaultPort);
+bool urlIsHttps(const String& url);
+bool tlsConfigure();
+bool tlsUploadCa();
+bool tcpOpen(int id, const String& host, uint16_t port, bool tls);
+void tcpWaitRecv(int id, uint32_t timeout);
+void tcpClose(int id);
+bool tcpSend(int id, const char* data, size_t len);
+int tcpRead(int id, uint8_t* buf, size_t maxLen, uint32_t timeout);
+void tcpOnUrc(const char* line);
+bool atWaitPrompt(uint32_t timeout);
+bool sinkWriteAt(StorageSink& sink, long offset, const uint8_t* data, size_t len);
+bool partitionDigest(const esp_partition_t* part, size_t size, HashAlgo algo, uint8_t* out);
 
 // ============================================================================
 // PUBLIC FUNCTIONS
@@ -43,28 +603,63 @@ void printProgress(size_t current, size_t total);
 bool system_init() {
     Serial.begin(115200);
     
-    // 1. CRITICAL FIX: Initialize SPIFFS
+    // 1. CRITICAL FIX: Initialize the staging filesystem (STAGING_LITTLEFS
+    // picks LittleFS; keep it in step with board_build.filesystem)
     // 'true' allows it to format the drive if it is corrupt or empty
-    if (!SPIFFS.begin(true)) {
-        Serial.println("CRITICAL ERROR: SPIFFS Mount Failed");
+    if (!STAGING_FS.begin(true)) {
+        Serial.println("CRITICAL ERROR: " STAGING_FS_NAME " Mount Failed");
         return false;
     }
-    Serial.println("✓ SPIFFS Mounted Successfully");
+    Serial.println("✓ " STAGING_FS_NAME " Mounted Successfully");
     return true;
 }
 
 bool gsm_setup() {
+    telemetryReset();
+    // Pins were latched across deep sleep so the modem saw no PWRKEY edge
+    gpio_hold_dis((gpio_num_t)PIN_CELL_PWRKEY);
+    gpio_hold_dis((gpio_num_t)PIN_CELL_RST);
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER) {
+        Serial.printf("Scheduled update check #%lu\n", (unsigned long)scheduledChecks);
+    }
     // 2. CRITICAL FIX: Increase RX Buffer to prevent overflow during Flash writes
-    CellUART.setRxBufferSize(CHUNK_SIZE + 512); 
+    // (the chunk pool goes to PSRAM, leaving internal RAM for a bigger ring)
+    if (!bufferPoolInit()) return false;
+    if (HASH_BENCHMARK) hashBenchmark();
+    if (AT_BENCHMARK) parserBenchmark();
+    size_t rxRing = bufferPool.psram ? CELL_RX_BUFFER : CHUNK_SIZE + 512;
+    CellUART.setRxBufferSize(rxRing);
+    cellRxRing = rxRing;
     CellUART.begin(BAUD_CELLULAR, SERIAL_8N1, PIN_CELL_RX, PIN_CELL_TX);
+
+    // Wake waiters from the driver's RX event (FIFO threshold or RX timeout)
+    if (cellRxSignal == NULL) cellRxSignal = xSemaphoreCreateBinary();
+    CellUART.setRxTimeout(CELL_RX_TIMEOUT_SYMBOLS);
+    CellUART.onReceive(onCellReceive, false);
     
     Serial.println("Connecting to GSM...");
-    
-    // Initial Modem Power Up Sequence
-    powerCycleModem();
+
+    // Fast path: a modem that survived our reboot may already be attached.
+    // One we left in PSM is deaf until PWRKEY, so wake it before probing
+    // rather than after a silent sweep of every baud rate.
+    modemWakeFromPsm();
+    bool alive = modemAlive();
+    if (alive && networkReady()) {
+        Serial.println("✓ Modem already registered with active PDP context");
+        enableFlowControl();
+        if (BAUD_NEGOTIATE) negotiateBaudRate(cellFlowControl ? CELL_BAUD_RATES[0] : BAUD_MAX_NO_FLOW);
+        return true;
+    }
+
+    // Initial Modem Power Up Sequence (only if it does not answer at all)
+    if (!alive) powerCycleModem();
 
     for(int i=0; i<3; i++) {
-        if(connectNetwork()) return true;
+        if(connectNetwork()) {
+            enableFlowControl();
+            if (BAUD_NEGOTIATE) negotiateBaudRate(cellFlowControl ? CELL_BAUD_RATES[0] : BAUD_MAX_NO_FLOW);
+            return true;
+        }
         Serial.println("Retrying GSM...");
         powerCycleModem();
     }
@@ -72,237 +667,2996 @@ bool gsm_setup() {
 }
 
 void startDownload() {
-    // Add cache busting timestamp
-    String finalURL = String(URL_BASE) + "?t=" + String(millis());
-    downloadAndVerify(finalURL);
+    bool ok = DOWNLOAD_MANIFEST ? startManifestDownload() : startImageDownload();
+    telemetryReport(ok);
+    downloaderEnter(ok ? DL_DONE : DL_FAILED);
+}
+
+// Non-blocking entry point: runs gsm_setup() + startDownload() in a task and
+// returns at once. Call gsm_poll() from loop(); it reports state changes to
+// onState and the result to onDone (either may be NULL). False if a run is
+// already in progress.
+bool gsm_begin(DownloadDoneCallback onDone, DownloadStateCallback onState) {
+    portENTER_CRITICAL(&downloaderLock);
+    bool busy = downloader.state != DL_IDLE && downloader.state != DL_DONE && downloader.state != DL_FAILED;
+    if (!busy) {
+        uint32_t run = downloader.run + 1;
+        downloader = DownloaderStatus();
+        downloader.run = run;
+        downloader.state = DL_CONNECTING;
+        downloader.startedMs = millis();
+    }
+    portEXIT_CRITICAL(&downloaderLock);
+    if (busy) return false;
+
+    downloaderOnDone = onDone;
+    downloaderOnState = onState;
+    if (xTaskCreatePinnedToCore(downloaderTask, "downloader", DOWNLOADER_STACK, NULL, DOWNLOADER_PRIORITY, NULL, DOWNLOADER_CORE) != pdPASS) {
+        Serial.println("✗ Failed to start downloader task");
+        downloaderEnter(DL_FAILED);
+        return false;
+    }
+    return true;
+}
+
+// Cheap; call every loop(). Callbacks run here, on the caller's task.
+// Returns true while a run is in progress.
+bool gsm_poll() {
+    static uint32_t reportedRun = 0;
+    static DownloaderState reported = DL_IDLE;
+    DownloaderStatus st = gsm_status();
+    DownloaderState state = st.state;
+    // A new run starts from idle, even if it already ended in the same state
+    // as the last one before this poll
+    if (st.run != reportedRun) {
+        reportedRun = st.run;
+        reported = DL_IDLE;
+    }
+    bool finished = state == DL_IDLE || state == DL_DONE || state == DL_FAILED;
+    if (state == reported) return !finished;
+    reported = state;
+    if (downloaderOnState) downloaderOnState(DL_STATE_NAMES[state]);
+    if (state != DL_IDLE && finished && downloaderOnDone) downloaderOnDone(state == DL_DONE);
+    return !finished;
+}
+
+DownloaderStatus gsm_status() {
+    portENTER_CRITICAL(&downloaderLock);
+    DownloaderStatus copy = downloader;
+    portEXIT_CRITICAL(&downloaderLock);
+    return copy;
+}
+
+bool startImageDownload() {
+    DownloadOptions opts = defaultDownloadOptions();
+
+    // The .sig is only fetched after a 200/206 body, so a 304 stays one request.
+    // A patch reconstructs this same image, so it is judged by the image's .sig.
+    opts.signedUrl = imageUrl();
+
+    // A patch keyed by the SHA-256 of what we hold now; 404 means none exists
+    uint8_t base[32];
+    if (DOWNLOAD_DELTA && deltaBaseDigest(opts.sink, opts.path, base)) {
+        char name[DELTA_NAME_LEN];
+        deltaPatchName(base, name, sizeof(name));
+        String patchUrl = String(DELTA_URL_BASE) + name;
+
+        DownloadOptions deltaOpts = opts;
+        deltaOpts.delta = true;
+        deltaOpts.gzip = DELTA_PATCH_GZIP;
+        deltaOpts.hash = HASH_SHA256;  // Checked against the patch header
+        if (downloadWithRetries(patchUrl, deltaOpts)) {
+            if (opts.sink == SINK_FILE) refreshValidators(String(imageUrl()), opts.path);
+            return true;
+        }
+        Serial.println("No usable patch for this base, falling back to full download");
+    }
+
+    // No cache buster: the CDN may serve this, and an unchanged file costs a 304
+    // (plus the patch lookup above with DOWNLOAD_DELTA)
+    return downloadWithRetries(String(imageUrl()), opts);
+}
+
+// Fetches MANIFEST_URL and downloads each listed file over the same HTTP
+// session, skipping entries whose stored SHA-256 already matches.
+bool startManifestDownload() {
+    static char manifest[MANIFEST_MAX_SIZE + 1];
+    static ManifestEntry entries[MANIFEST_MAX_ENTRIES];
+
+    Serial.println("\n--- FETCHING MANIFEST ---");
+    // No cache buster: the last manifest is kept with its validators, so an
+    // unchanged one costs a 304 and is read back from flash
+    HttpValidators cached;
+    String headers;
+    if (STAGING_FS.exists(MANIFEST_PATH) && loadValidators(MANIFEST_PATH, cached)) {
+        if (cached.etag[0]) headers += "If-None-Match: " + String(cached.etag) + "\r\n";
+        if (cached.lastModified[0]) headers += "If-Modified-Since: " + String(cached.lastModified) + "\r\n";
+    }
+    HttpValidators fresh;
+    long len = httpFetchToBuffer(String(manifestUrl()), manifest, MANIFEST_MAX_SIZE, headers, &fresh);
+    if (len == 0 && headers.length()) {
+        File f = STAGING_FS.open(MANIFEST_PATH, FILE_READ);
+        len = f ? (long)f.read((uint8_t*)manifest, MANIFEST_MAX_SIZE) : -1;
+        if (f) f.close();
+        if (len > 0) Serial.println("✓ Manifest unchanged (304), using the stored copy");
+        // A lost stored copy must not keep answering 304 with nothing to read
+        else STAGING_FS.remove(String(MANIFEST_PATH) + ".meta");
+    } else if (len > 0) {
+        File f = STAGING_FS.open(MANIFEST_PATH, FILE_WRITE);
+        if (f) {
+            f.write((const uint8_t*)manifest, len);
+            f.close();
+            saveValidators(MANIFEST_PATH, fresh);
+        }
+    }
+    if (len <= 0) {
+        Serial.println("✗ Manifest download failed");
+        return false;
+    }
+    manifest[len] = 0;
+
+    int count = parseManifest(manifest, len, entries, MANIFEST_MAX_ENTRIES);
+    if (count < 0) return false;
+    Serial.printf("✓ Manifest lists %d file(s)\n", count);
+
+    bool allOk = true;
+    for (int i = 0; i < count; i++) {
+        ManifestEntry& e = entries[i];
+        Serial.printf("\n[%d/%d] %s -> %s (%ld bytes)\n", i + 1, count, e.url,
+                      e.sink == SINK_OTA ? "OTA" : e.path, e.size);
+        if (manifestEntryCurrent(e)) {
+            Serial.println("✓ Up to date, skipping");
+            continue;
+        }
+
+        DownloadOptions opts = defaultDownloadOptions();
+        opts.sink = e.sink;
+        opts.path = e.path;
+        opts.hash = HASH_SHA256;
+        opts.expectedDigest = e.sha256;
+        opts.gzip = e.gzip;
+        if (e.sigLen > 0) {
+            opts.signature = e.sig;
+            opts.signatureLen = e.sigLen;
+        } else {
+            opts.signedUrl = e.url;
+        }
+        if (!downloadWithRetries(String(e.url), opts)) allOk = false;
+    }
+    return allOk;
+}
+
+DownloadOptions defaultDownloadOptions() {
+    DownloadOptions opts;
+    opts.sink = DOWNLOAD_SINK;
+    opts.path = FILE_PATH;
+    opts.hash = DOWNLOAD_HASH;
+    opts.expectedDigest = EXPECTED_DIGEST;
+    opts.verifyReadback = VERIFY_READBACK;
+    opts.resume = DOWNLOAD_RESUME;
+    opts.gzip = DOWNLOAD_GZIP;
+    opts.delta = false;
+    opts.signature = NULL;
+    opts.signatureLen = 0;
+    opts.signedUrl = NULL;
+    if (*SIGNING_PUBLIC_KEY) opts.hash = HASH_SHA256;  // What signatures cover
+    return opts;
+}
+
+bool downloadWithRetries(const String& url, const DownloadOptions& opts) {
+    // Each failed attempt leaves a resume point, so retries make forward progress
+    for (int i = 0; i < DOWNLOAD_ATTEMPTS; i++) {
+        // Reuses the bearer when healthy, re-activates it if it dropped
+        if (i > 0 && !connectNetwork()) {
+            Serial.println("✗ Data bearer lost");
+            continue;
+        }
+        if (downloadAndVerify(url, opts)) return true;
+        Serial.printf("Download attempt %d/%d failed\n", i + 1, DOWNLOAD_ATTEMPTS);
+        telemetry.retries++;
+        // Asking again will not make a 404 appear
+        if (lastHttpStatus >= 400 && lastHttpStatus < 500) return false;
+        // Dropped bytes at a high rate look like a stalled stream; back off
+        if (BAUD_NEGOTIATE) lowerBaudRate();
+    }
+    return false;
 }
 
 // ============================================================================
 // INTERNAL HELPERS
 // ============================================================================
 
-void downloadAndVerify(const String& downloadUrl) {
+bool downloadAndVerify(const String& downloadUrl, const DownloadOptions& opts) {
     Serial.println("\n----------------------------------------------");
     Serial.println("STARTING DOWNLOAD (Rectified Version)");
     Serial.println("----------------------------------------------");
+    downloaderEnter(DL_DOWNLOADING);
 
-    // 1. Prepare Modem
-    sendAT("ATE0", "OK", 1000);
-    sendAT("AT+QHTTPSTOP", "OK", 1000);
-    sendAT("AT+QHTTPCFG=\"responseheader\",0", "OK", 1000);
+    // Several ranged GETs in flight fill the radio link better than one
+    // TCP window; anything it cannot handle falls back to the single stream.
+    if (DOWNLOAD_SEGMENTS > 1 && !opts.gzip && !opts.delta) {
+        if (segmentedDownload(downloadUrl, opts)) return true;
+        if (lastHttpStatus >= 400 && lastHttpStatus < 500) return false;
+        Serial.println("Falling back to a single HTTP stream");
+    }
 
-    // 2. Set URL
-    CellUART.println("AT+QHTTPURL=" + String(downloadUrl.length()) + ",80");
-    if (waitForResponse(5000).indexOf("CONNECT") == -1) {
-        Serial.println("✗ Error: URL CONNECT failed");
-        return;
+    // 1. Pick up a previous partial download (SPIFFS only; OTA slots restart).
+    // Inflater/patcher state cannot be persisted, so those downloads restart.
+    bool canResume = opts.resume && opts.sink == SINK_FILE && !opts.gzip && !opts.delta;
+    ResumeState resume;
+    bool resuming = canResume && loadResumeState(resume, downloadUrl, opts.path, opts.hash);
+    String headers;
+    if (resuming) {
+        Serial.printf("↻ Resuming at %ld / %ld bytes\n", resume.point.offset, resume.point.totalSize);
+        headers = "Range: bytes=" + String(resume.point.offset) + "-\r\n";
+        if (resume.point.etag[0]) headers += "If-Range: " + String(resume.point.etag) + "\r\n";
     }
-    CellUART.print(downloadUrl);
-    waitForResponse(5000);
 
-    // 3. HTTP GET (Download from Server to Modem)
-    // We give the modem 60s to connect to server and headers
-    CellUART.println("AT+QHTTPGET=80"); 
-    
+    // Ask the server to skip the body if our stored copy is still current
+    HttpValidators cached;
+    if (!resuming && !opts.delta && opts.sink == SINK_FILE && STAGING_FS.exists(opts.path) && loadValidators(opts.path, cached)) {
+        if (cached.etag[0]) headers += "If-None-Match: " + String(cached.etag) + "\r\n";
+        if (cached.lastModified[0]) headers += "If-Modified-Since: " + String(cached.lastModified) + "\r\n";
+    }
+
+    // 2-3. Set URL and issue the GET (Download from Server to Modem). The
+    // socket transport has the response headers in hand once this returns.
+    HttpTransport transport = DOWNLOAD_TRANSPORT;
+    bool useTcp = transport == TRANSPORT_TCP;
+    int status = 0;
     long fileSize = -1;
-    unsigned long startWait = millis();
-    bool getSizeSuccess = false;
-
-    // Wait for +QHTTPGET: 0,200,<size>
-    while (millis() - startWait < 80000) { 
-        if (CellUART.available()) {
-            String line = CellUART.readStringUntil('\n');
-            if (line.startsWith("+QHTTPGET: 0,200")) {
-                fileSize = line.substring(line.lastIndexOf(',') + 1).toInt();
-                Serial.printf("✓ Target File Size: %ld bytes\n", fileSize);
-                getSizeSuccess = true;
-                break;
-            }
-            if (line.startsWith("+QHTTPGET: ") && !line.startsWith("+QHTTPGET: 0,200")) {
-                 Serial.println("✗ HTTP GET Error: " + line);
-                 return;
-            }
-        }
+    HttpValidators fresh;
+    uint32_t phaseStart = millis();
+    bool got = useTcp ? tcpHttpGet(downloadUrl, headers, TCP_DATA_ID, status, fileSize, fresh)
+                      : httpGet(downloadUrl, headers, status, fileSize);
+    telemetryAdd(TM_HTTP_GET, millis() - phaseStart);
+    if (!got) return false;
+
+    if (status == 304) {
+        Serial.println("✓ Up to date (304 Not Modified), nothing to download");
+        return true;
     }
 
-    if (!getSizeSuccess || fileSize <= 0) {
-        Serial.println("✗ Failed to get file size. Check URL or Network.");
-        return;
+    long offset = 0;
+    long totalSize = fileSize;
+    if (resuming && resumeContinues(resume.point, status, fileSize)) {
+        offset = resume.point.offset;
+        totalSize = resume.point.totalSize;
+    } else if (status != 200) {
+        Serial.printf("✗ HTTP GET Error: status %d\n", status);
+        if (status == 206 || status == 416) clearResumeState();  // Server no longer agrees with our state
+        if (useTcp && status == 206) tcpClose(TCP_DATA_ID);
+        return false;
+    } else if (resuming) {
+        Serial.println("  (Server sent full body, restarting from zero)");
+        resuming = false;
     }
 
-    // 4. Clean SPIFFS before writing
-    if (SPIFFS.exists(FILE_PATH)) SPIFFS.remove(FILE_PATH);
-    
-    // NOTE: SPIFFS.begin() must have been called in system_init() for this to work
-    File file = SPIFFS.open(FILE_PATH, FILE_WRITE);
-    if (!file) {
-        Serial.println("✗ SPIFFS Write Error - Did you call SPIFFS.begin()?"); 
-        return;
+    GzipInflater* inflater = NULL;
+    DeltaPatcher* patcher = NULL;
+    String targetPath = opts.path;
+    bool ready = fileSize > 0;
+    if (!ready) Serial.println("✗ Failed to get file size. Check URL or Network.");
+    else Serial.printf("✓ Target File Size: %ld bytes (fetching %ld)\n", totalSize, fileSize);
+
+    if (ready && opts.gzip) ready = (inflater = gzipBegin()) != NULL;
+
+    // A patched SPIFFS file is built next to its base and swapped in at the end
+    if (ready && opts.delta) {
+        ready = (patcher = deltaBegin(opts.sink, opts.path)) != NULL;
+        targetPath += ".new";
+    }
+
+    // 4. Open the write sink (cleans SPIFFS / erases the OTA slot up front).
+    // The output size is unknown until the gzip trailer / patch header arrives.
+    StorageSink sink;
+    if (ready && !sinkBegin(sink, opts.sink, targetPath.c_str(), opts.gzip || opts.delta ? 0 : totalSize, offset)) {
+        if (patcher) deltaEnd(*patcher);
+        ready = false;
+    }
+    if (!ready) {
+        if (useTcp) tcpClose(TCP_DATA_ID);
+        return false;
     }
+    if (!resuming) clearResumeState();
 
     // 5. Read Data (Modem to ESP32)
-    // Timeout increased to 300 seconds (5 mins) for 1MB file
-    CellUART.println("AT+QHTTPREAD=300");
-
-    // Wait for CONNECT
-    unsigned long connectTime = millis();
-    bool connected = false;
-    while (millis() - connectTime < 10000) {
-        if (CellUART.available()) {
-            String line = CellUART.readStringUntil('\n');
-            if (line.indexOf("CONNECT") != -1) {
-                connected = true;
-                break;
-            }
-        }
+    // UFS: the modem stores the body while the UART sits idle (we block on
+    // the RX event, so the core can sleep), then we burst it out of its file.
+    bool connected = true;
+    int ufsHandle = -1;
+    phaseStart = millis();
+    if (transport == TRANSPORT_UFS && !ufsHasRoom(fileSize)) {
+        Serial.println("Not enough modem UFS space, streaming directly");
+        transport = TRANSPORT_QHTTP;
     }
+    if (transport == TRANSPORT_UFS) {
+        connected = ufsStoreBody() && (ufsHandle = ufsOpenBody(fresh)) >= 0;
+        if (!connected) ufsClose(ufsHandle);
+    } else if (!useTcp) {
+        // 300 seconds (5 mins) for a 1MB file. The body is preceded by the
+        // response headers; keep the validators
+        HttpHeaderParser head;
+        connected = qhttpReadBegin(atChannel, qhttp, 300, head, 10000);
+        if (connected) fresh = head.validators;
+        else Serial.printf("✗ %s\n", qhttp.error);
+    }
+
+    telemetryAdd(TM_CONNECT_WAIT, millis() - phaseStart);
 
     if (!connected) {
         Serial.println("✗ Modem did not start data stream (No CONNECT)");
-        file.close();
-        return;
+        if (resuming) sinkSuspend(sink);
+        else sinkEnd(sink, false);
+        if (patcher) deltaEnd(*patcher);
+        return false;
     }
 
-    // 6. Binary Read Loop
-    long bytesDownloaded = 0;
-    
-    // FIX: Check if malloc succeeded
-    uint8_t* buffer = (uint8_t*)malloc(CHUNK_SIZE);
-    if(buffer == NULL) {
-        Serial.println("✗ Memory Allocation Failed");
-        file.close();
-        return;
+    // 6. Binary Read Loop (reader/writer tasks)
+    StreamHash hash;
+    if (resuming) hash = resume.hash;
+    else hashBegin(hash, opts.hash);
+
+    unsigned long transferStart = millis();
+    long imageSize = 0;
+    long bytesDownloaded = runDownloadPipeline(sink, hash, inflater, patcher, transport,
+                                               useTcp ? TCP_DATA_ID : ufsHandle, fileSize, offset, &imageSize);
+    imageSize += offset;
+    if (patcher) deltaEnd(*patcher);  // Base no longer needed
+    downloaderEnter(DL_VERIFYING);
+    unsigned long transferMs = millis() - transferStart;
+    telemetryAdd(TM_TRANSFER, transferMs);
+    telemetry.bytes += bytesDownloaded;
+
+    // 10 bits per byte on the wire (8N1)
+    Serial.printf("Throughput: %.1f KB/s over %lu ms @ %lu baud (wire limit %.1f KB/s)\n",
+                  transferMs ? bytesDownloaded / 1.024 / transferMs : 0.0, transferMs,
+                  (unsigned long)cellBaud, cellBaud / 10240.0);
+
+    if (bytesDownloaded != fileSize) {
+        long stored = offset + bytesDownloaded;
+        Serial.printf("\n✗ Download INCOMPLETE: %ld / %ld bytes\n", stored, totalSize);
+        if (canResume && stored > 0) {
+            Serial.println("  (Keeping partial file for resume...)");
+            const char* etag = fresh.etag[0] || !resuming ? fresh.etag : resume.point.etag;
+            saveResumeState(downloadUrl, stored, totalSize, etag, hash);
+            sinkSuspend(sink);
+        } else {
+            Serial.println("  (Discarding incomplete image...)");
+            sinkEnd(sink, false);
+        }
+        uint8_t scratch[HASH_MAX_LEN];
+        hashFinish(hash, scratch);  // Releases the context
+        if (useTcp) {
+            tcpClose(TCP_DATA_ID);  // Never left command mode; nothing to drain
+        } else if (transport == TRANSPORT_UFS) {
+            ufsClose(ufsHandle);
+        } else {
+            drainModem(2000, 30000);    // Let the modem leave data mode before the next command
+            httpSessionReady = false;
+        }
+        return false;
     }
 
-    unsigned long lastAct = millis();
-    const unsigned long INACTIVITY_TIMEOUT = 60000; 
+    // Consume the trailing OK / +QHTTPREAD: 0 so the next request starts clean
+    if (useTcp) tcpClose(TCP_DATA_ID);
+    else if (transport == TRANSPORT_UFS) ufsClose(ufsHandle);
+    else atWaitFor("+QHTTPREAD:", 1000, false);
 
-    while (bytesDownloaded < fileSize) {
-        // Feed watchdog
-        yield(); 
+    bool decodeOk = true;
+    if (inflater && !gzipComplete(*inflater)) {
+        Serial.println("✗ Compressed stream ended early or failed its CRC");
+        decodeOk = false;
+    }
+    if (patcher && !deltaComplete(*patcher)) {
+        Serial.println("✗ Patch ended early or produced the wrong size");
+        decodeOk = false;
+    }
+    if (!decodeOk) {
+        uint8_t scratch[HASH_MAX_LEN];
+        hashFinish(hash, scratch);
+        sinkEnd(sink, false);
+        return false;
+    }
 
-        if (CellUART.available()) {
-            size_t toRead = min((size_t)CHUNK_SIZE, (size_t)CellUART.available());
-            
-            // Cap read to remaining file size (prevents reading trailing OK)
-            if ((bytesDownloaded + toRead) > fileSize) {
-                toRead = fileSize - bytesDownloaded;
-            }
+    uint8_t digest[HASH_MAX_LEN];
+    hashFinish(hash, digest);
 
-            int len = CellUART.readBytes(buffer, toRead);
-            if (len > 0) {
-                file.write(buffer, len);
-                bytesDownloaded += len;
-                lastAct = millis();
-                if (bytesDownloaded % 51200 == 0) printProgress(bytesDownloaded, fileSize);
-            }
+    Serial.printf("\n✓ Download Success: %ld / %ld bytes\n", totalSize, totalSize);
+    if (inflater) Serial.printf("  (inflated to %ld bytes, %ld%% saved on the wire)\n", imageSize,
+                                imageSize ? 100 - (totalSize * 100) / imageSize : 0);
+    return finishDownload(sink, opts, digest, imageSize, targetPath.c_str(), patcher ? patcher->targetSha : NULL, fresh);
+}
+
+// The common tail of every download (single stream and segmented) once the
+// body is in and the transport is closed: checks the digest and signature,
+// commits the sink, optionally reads the image back and records what is now
+// stored. storedPath is where a SINK_FILE image landed; with patchTargetSha
+// (the target a patch promised) it is swapped into opts.path at the end.
+bool finishDownload(StorageSink& sink, const DownloadOptions& opts, const uint8_t* digest, long imageSize,
+                    const char* storedPath, const uint8_t* patchTargetSha, const HttpValidators& validators) {
+    size_t digestLen = opts.hash == HASH_SHA256 ? 32 : 16;
+    clearResumeState();  // Whatever happens next, no partial download is left to continue
+    printDigest(opts.hash, digest, digestLen);
+
+    // Reject before committing so a bad image never becomes bootable
+    if (opts.expectedDigest && *opts.expectedDigest) {
+        if (!digestMatchesHex(digest, digestLen, opts.expectedDigest)) {
+            Serial.printf("✗ Digest mismatch (expected %s) - rejecting image\n", opts.expectedDigest);
+            sinkEnd(sink, false);
+            return false;
         }
-        
-        if (millis() - lastAct > INACTIVITY_TIMEOUT) {
-            Serial.println("\n✗ ERROR: Data stream timed out (Host inactive)");
-            break;
+        Serial.println("✓ Digest matches expected value");
+    }
+
+    // A patched image must always reproduce the target its header promises
+    if (patchTargetSha && memcmp(digest, patchTargetSha, 32) != 0) {
+        Serial.println("✗ Patched image does not match target SHA-256 - rejecting");
+        sinkEnd(sink, false);
+        return false;
+    }
+
+    if (!signatureAccepted(opts, opts.hash, digest)) {
+        sinkEnd(sink, false);
+        return false;
+    }
+
+    // OTA is checked before esp_ota_end() so a mismatch never sets the boot slot;
+    // the SPIFFS file has to be closed before it can be read back.
+    if (opts.verifyReadback && opts.sink == SINK_OTA) {
+        if (!calculatePartitionChecksum(sink.partition, imageSize, opts.hash, digest)) {
+            sinkEnd(sink, false);
+            return false;
         }
     }
 
-    file.close();
-    free(buffer);
+    if (!sinkEnd(sink, true)) return false;
+    if (opts.sink == SINK_OTA) {
+        if (opts.hash == HASH_SHA256) saveOtaDigest(digest);
+        return true;
+    }
+    if (opts.sink == SINK_RAW) {
+        if (opts.verifyReadback && !calculatePartitionChecksum(sink.partition, imageSize, opts.hash, digest)) return false;
+        if (opts.hash == HASH_SHA256) saveRawInfo(imageSize, digest);
+        return true;
+    }
+    if (opts.verifyReadback && !calculateStorageChecksum(storedPath, opts.hash, digest)) {
+        STAGING_FS.remove(storedPath);
+        return false;
+    }
+    if (patchTargetSha) {
+        STAGING_FS.remove(opts.path);
+        if (!STAGING_FS.rename(storedPath, opts.path)) {
+            Serial.println("✗ Could not replace base file with patched image");
+            return false;
+        }
+        // The validators describe the old full download, not this one;
+        // startImageDownload() fetches the target's with refreshValidators()
+        HttpValidators none = {};
+        saveValidators(opts.path, none);
+        return true;
+    }
+    saveValidators(opts.path, validators);
+    return true;
+}
 
-    if (bytesDownloaded == fileSize) {
-        Serial.printf("\n✓ Download Success: %ld / %ld bytes\n", bytesDownloaded, fileSize);
-        calculateStorageChecksum();
-    } else {
-        Serial.printf("\n✗ Download INCOMPLETE: %ld / %ld bytes\n", bytesDownloaded, fileSize);
-        Serial.println("  (Deleting incomplete file...)");
-        SPIFFS.remove(FILE_PATH); 
+// Points the modem at url and issues AT+QHTTPGET. extraHeaders (each ending in
+// \r\n) switch the modem to custom request header mode so we can send our own
+// GET. On success status/length hold the HTTP code and Content-Length.
+bool httpGet(const String& url, const String& extraHeaders, int& status, long& length) {
+    bool customHeader = extraHeaders.length() > 0;
+    String request;
+    if (customHeader) {
+        String host, path;
+        if (!splitUrl(url, host, path)) {
+            Serial.println("✗ Error: Cannot parse URL");
+            return false;
+        }
+        request = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\n" + extraHeaders + "\r\n";
     }
+
+    if (!httpSessionOpen(urlIsHttps(url))) return false;
+    lastHttpStatus = 0;
+    bool ok = qhttpGet(atChannel, qhttp, url.c_str(), request.c_str(), status, length);
+    lastHttpStatus = status;
+    if (!ok) {
+        Serial.printf("✗ Error: %s (%s)\n", qhttp.error, atChannel.parser.line);
+        return false;
+    }
+    return true;
 }
 
-void calculateStorageChecksum() {
-    Serial.println("\n--- VERIFYING SPIFFS FILE ---");
-    File file = SPIFFS.open(FILE_PATH, FILE_READ);
-    if (!file) {
-        Serial.println("Failed to open file for verification");
-        return;
+// One-time HTTP configuration, kept for every following request (manifest and
+// all its files) until a failure or power cycle invalidates it. TLS is only
+// set up the first time the session meets an https:// URL.
+bool httpSessionOpen(bool tls) {
+    if (!httpSessionReady) {
+        sendAT("ATE0", "OK", 1000);
+        sendAT("AT+QHTTPSTOP", "OK", 1000);
+        if (!sendAT("AT+QHTTPCFG=\"contextid\",1", "OK", 1000)) return false;
+        // Headers come back ahead of the body so we can pick up ETag/Last-Modified
+        if (!sendAT("AT+QHTTPCFG=\"responseheader\",1", "OK", 1000)) return false;
+        qhttpSessionReset(qhttp);
+        httpSessionTls = false;
+        httpSessionReady = true;
+    }
+    if (tls && !httpSessionTls) {
+        // https:// URLs use the shared TLS context, so every QHTTPGET of the
+        // session (manifest, signature, files) can resume the same TLS session
+        char cmd[40];
+        snprintf(cmd, sizeof(cmd), "AT+QHTTPCFG=\"sslctxid\",%d", TLS_CTX_ID);
+        if (!tlsConfigure() || !sendAT(cmd, "OK", 1000)) return false;
+        httpSessionTls = true;
     }
+    return true;
+}
 
-    mbedtls_md5_context md5_ctx;
-    mbedtls_md5_init(&md5_ctx);
-    mbedtls_md5_starts_ret(&md5_ctx);
+// GETs a small body (e.g. the manifest) into buf. Returns its length, 0 on
+// 304 Not Modified (buf untouched), or -1. validators, if given, receive the
+// response's ETag / Last-Modified.
+long httpFetchToBuffer(const String& url, char* buf, size_t cap, const String& extraHeaders, HttpValidators* validators) {
+    int status = 0;
+    long length = -1;
+    if (!httpGet(url, extraHeaders, status, length)) return -1;
+    if (status == 304) return 0;
+    if (status != 200 || length <= 0 || (size_t)length > cap) {
+        Serial.printf("✗ Unexpected response: status %d, %ld bytes\n", status, length);
+        return -1;
+    }
 
-    uint8_t* vBuf = (uint8_t*)malloc(CHUNK_SIZE);
-    if (!vBuf) {
-        file.close();
-        Serial.println("Memory error in verification");
-        return;
+    HttpHeaderParser head;
+    if (!qhttpReadBegin(atChannel, qhttp, 60, head, 10000)) {
+        Serial.printf("✗ %s\n", qhttp.error);
+        httpSessionReady = false;
+        return -1;
     }
+    if (validators) *validators = head.validators;
 
-    while (file.available()) {
-        int len = file.read(vBuf, CHUNK_SIZE);
-        mbedtls_md5_update_ret(&md5_ctx, vBuf, len);
+    long got = 0;
+    uint32_t lastAct = millis();
+    while (got < length) {
+        if (!cellWaitForData(lastAct, 10000)) break;
+        got += cellLink.read((uint8_t*)buf + got, min((size_t)cellLink.available(), (size_t)(length - got)));
+        lastAct = millis();
     }
+    qhttpReadEnd(atChannel);
 
-    uint8_t md5Res[16];
-    mbedtls_md5_finish_ret(&md5_ctx, md5Res);
-    
-    file.close();
-    free(vBuf);
-    mbedtls_md5_free(&md5_ctx);
+    if (got != length) {
+        httpSessionReady = false;
+        return -1;
+    }
+    return got;
+}
 
-    Serial.print("MD5: ");
-    for (int i = 0; i < 16; i++) Serial.printf("%02x", md5Res[i]);
-    Serial.println("\n----------------------------------------------");
+// Fills entries from the manifest JSON. Returns the entry count or -1.
+int parseManifest(const char* json, size_t len, ManifestEntry* entries, int maxEntries) {
+    JsonDocument doc;
+    DeserializationError err = deserializeJson(doc, json, len);
+    if (err) {
+        Serial.printf("✗ Manifest parse error: %s\n", err.c_str());
+        return -1;
+    }
+
+    JsonArrayConst files = doc["files"];
+    int count = 0;
+    for (JsonVariantConst f : files) {
+        if (count >= maxEntries) {
+            Serial.printf("✗ Manifest has more than %d entries, ignoring the rest\n", maxEntries);
+            break;
+        }
+        const char* url = f["url"] | "";
+        const char* sha = f["sha256"] | "";
+        const char* path = f["path"] | FILE_PATH;
+        const char* sink = f["sink"] | "file";
+        if (!*url || strlen(url) >= sizeof(entries[0].url) || strlen(sha) != 64 ||
+            strlen(path) >= sizeof(entries[0].path)) {
+            Serial.println("✗ Skipping malformed manifest entry");
+            continue;
+        }
+
+        ManifestEntry& e = entries[count++];
+        strcpy(e.url, url);
+        strcpy(e.path, path);
+        strcpy(e.sha256, sha);
+        e.size = f["size"] | -1L;
+        e.sigLen = hexToBytes(f["sig"] | "", e.sig, sizeof(e.sig));
+        e.sink = strcmp(sink, "ota") == 0 ? SINK_OTA : strcmp(sink, "raw") == 0 ? SINK_RAW : SINK_FILE;
+        e.gzip = f["gzip"] | false;
+    }
+    return count;
 }
 
-bool connectNetwork() {
-    sendAT("ATE0", "OK", 1000);
-    if (!sendAT("AT+CPIN?", "READY", 2000)) return false;
-    sendAT("AT+QIDEACT=1", "OK", 5000);
-    // Be sure APN is correct
-    if (!sendAT("AT+QICSGP=1,1,\"airtelgprs.com\",\"\",\"\",1", "OK", 2000)) return false;
-    if (!sendAT("AT+QIACT=1", "OK", 10000)) return false;
-    return true;
+// True when what we already hold matches the entry's SHA-256, which costs a
+// flash read instead of cellular data.
+bool manifestEntryCurrent(const ManifestEntry& e) {
+    uint8_t digest[HASH_MAX_LEN];
+    if (e.sink == SINK_OTA) {
+        File f = STAGING_FS.open(OTA_DIGEST_PATH, FILE_READ);
+        if (!f) return false;
+        size_t n = f.read(digest, 32);
+        f.close();
+        return n == 32 && digestMatchesHex(digest, 32, e.sha256);
+    }
+    if (e.sink == SINK_RAW) {
+        long size = -1;
+        File f = STAGING_FS.open(RAW_INFO_PATH, FILE_READ);
+        if (!f) return false;
+        bool ok = f.read((uint8_t*)&size, sizeof(size)) == sizeof(size) && f.read(digest, 32) == 32;
+        f.close();
+        return ok && (e.size <= 0 || e.gzip || size == e.size) && digestMatchesHex(digest, 32, e.sha256);
+    }
+    if (!STAGING_FS.exists(e.path)) return false;
+    if (e.size > 0 && !e.gzip) {
+        File f = STAGING_FS.open(e.path, FILE_READ);
+        bool sizeOk = f && (long)f.size() == e.size;
+        if (f) f.close();
+        if (!sizeOk) return false;
+    }
+    return storedFileDigest(e.path, HASH_SHA256, digest) && digestMatchesHex(digest, 32, e.sha256);
 }
 
-void powerCycleModem() {
-    Serial.println("Power cycling modem...");
-    pinMode(PIN_CELL_RST, OUTPUT);
-    pinMode(PIN_CELL_PWRKEY, OUTPUT);
+void saveOtaDigest(const uint8_t* digest) {
+    File f = STAGING_FS.open(OTA_DIGEST_PATH, FILE_WRITE);
+    if (!f) return;
+    f.write(digest, 32);
+    f.close();
+}
 
-    // Reset Sequence
-    digitalWrite(PIN_CELL_RST, HIGH);
-    delay(200);
-    digitalWrite(PIN_CELL_RST, LOW);
-    delay(3000);
+// Splits http(s)://host[:port]/path into "host[:port]" and "/path".
+bool splitUrl(const String& url, String& host, String& path) {
+    int schemeEnd = url.indexOf("://");
+    if (schemeEnd == -1) return false;
+    int hostStart = schemeEnd + 3;
+    int pathStart = url.indexOf('/', hostStart);
+    if (pathStart == -1) {
+        host = url.substring(hostStart);
+        path = "/";
+    } else {
+        host = url.substring(hostStart, pathStart);
+        path = url.substring(pathStart);
+    }
+    return host.length() > 0;
+}
 
-    // Power Key Sequence
-    digitalWrite(PIN_CELL_PWRKEY, HIGH);
-    delay(1000);
-    digitalWrite(PIN_CELL_PWRKEY, LOW);
-    delay(5000);
+bool loadResumeState(ResumeState& state, const String& url, const char* path, HashAlgo algo) {
+    File f = STAGING_FS.open(RESUME_PATH, FILE_READ);
+    if (!f) return false;
+    size_t n = f.read((uint8_t*)&state, sizeof(state));
+    f.close();
+
+    // The partial file must still be exactly what the hash state covers
+    File part = STAGING_FS.open(path, FILE_READ);
+    long partSize = part ? (long)part.size() : -1;
+    if (part) part.close();
+    bool valid = n == sizeof(state) && state.hash.algo == algo &&
+                 resumePointValid(state.point, url.c_str(), sizeof(StreamHash), partSize);
+    if (!valid) clearResumeState();
+    return valid;
+}
+
+void saveResumeState(const String& url, long offset, long totalSize, const char* etag, const StreamHash& hash) {
+    ResumeState state;
+    resumePointSet(state.point, url.c_str(), offset, totalSize, etag, sizeof(StreamHash));
+    state.hash = hash;
+
+    File f = STAGING_FS.open(RESUME_PATH, FILE_WRITE);
+    if (!f) {
+        Serial.println("✗ Could not save resume state");
+        return;
+    }
+    f.write((const uint8_t*)&state, sizeof(state));
+    f.close();
+}
+
+void clearResumeState() {
+    if (STAGING_FS.exists(RESUME_PATH)) STAGING_FS.remove(RESUME_PATH);
+}
+
+bool loadValidators(const char* path, HttpValidators& v) {
+    String metaPath = String(path) + ".meta";
+    File f = STAGING_FS.open(metaPath, FILE_READ);
+    if (!f) return false;
+    bool ok = f.read((uint8_t*)&v, sizeof(v)) == sizeof(v);
+    f.close();
+    v.etag[VALIDATOR_MAX - 1] = 0;
+    v.lastModified[VALIDATOR_MAX - 1] = 0;
+    return ok && (v.etag[0] || v.lastModified[0]);
+}
+
+void saveValidators(const char* path, const HttpValidators& v) {
+    String metaPath = String(path) + ".meta";
+    if (!v.etag[0] && !v.lastModified[0]) {
+        if (STAGING_FS.exists(metaPath)) STAGING_FS.remove(metaPath);
+        return;
+    }
+    File f = STAGING_FS.open(metaPath, FILE_WRITE);
+    if (!f) return;
+    f.write((const uint8_t*)&v, sizeof(v));
+    f.close();
 }
 
-bool sendAT(String cmd, const char* expected, uint32_t timeout) {
-    if (cmd.length()) CellUART.println(cmd);
+// Discards modem output until the line has been quiet for quietMs, e.g. the
+// rest of an aborted AT+QHTTPREAD stream and its trailing result code.
+void drainModem(uint32_t quietMs, uint32_t maxMs) {
     uint32_t start = millis();
-    String resp = "";
-    while (millis() - start < timeout) {
-        if (CellUART.available()) {
-            resp += char(CellUART.read());
-            if (resp.indexOf(expected) != -1) return true;
+    uint32_t lastAct = start;
+    while (millis() - lastAct < quietMs && millis() - start < maxMs) {
+        if (cellWaitForData(lastAct, quietMs)) {
+            while (cellLink.available()) cellLink.read();
+            lastAct = millis();
         }
     }
-    return false;
 }
 
-String waitForResponse(uint32_t timeout) {
-    String resp = "";
-    uint32_t start = millis();
-    while (millis() - start < timeout) {
-        while (CellUART.available()) resp += char(CellUART.read());
+// Runs the UART reader and storage writer tasks until the whole body has been
+// written or one side gives up. Returns the number of bytes written to the sink.
+// With an inflater and/or patcher the sink receives the decoded bytes;
+// *outputBytes reports how many reached it.
+long runDownloadPipeline(StorageSink& sink, StreamHash& hash, GzipInflater* inflater, DeltaPatcher* patcher, HttpTransport transport, int handle, long fileSize, long baseOffset, long* outputBytes) {
+    *outputBytes = 0;
+    if (!bufferPoolInit()) return 0;
+
+    DownloadPipeline p;
+    p.freeQueue = xQueueCreate(PIPELINE_CHUNKS, sizeof(uint8_t));
+    p.fullQueue = xQueueCreate(PIPELINE_CHUNKS + 1, sizeof(uint8_t));
+    p.sink = &sink;
+    p.hash = &hash;
+    p.inflater = inflater;
+    p.patcher = patcher;
+    p.transport = transport;
+    p.handle = handle;
+    p.fileSize = fileSize;
+    p.baseOffset = baseOffset;
+    p.totalSize = baseOffset + fileSize;
+    downloaderProgress(baseOffset, p.totalSize);
+    p.bytesRead = 0;
+    p.bytesWritten = 0;
+    p.outputBytes = 0;
+    p.hashUs = 0;
+    p.writeUs = 0;
+    p.stallMs = 0;
+    p.timedOut = false;
+    p.writeFailed = false;
+    p.owner = xTaskGetCurrentTaskHandle();
+
+    if (p.freeQueue == NULL || p.fullQueue == NULL) {
+        Serial.println("✗ Pipeline queue allocation failed");
+        if (p.freeQueue) vQueueDelete(p.freeQueue);
+        if (p.fullQueue) vQueueDelete(p.fullQueue);
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < PIPELINE_CHUNKS; i++) {
+        p.chunks[i].data = bufferPool.chunks[i];
+        p.chunks[i].len = 0;
+        xQueueSend(p.freeQueue, &i, 0);
+    }
+
+    // Writer first so it is already blocked on the queue when data arrives
+    if (xTaskCreatePinnedToCore(pipelineWriterTask, "dl_writer", PIPELINE_STACK, &p, 4, NULL, PIPELINE_WRITER_CORE) != pdPASS) {
+        Serial.println("✗ Failed to start writer task");
+        vQueueDelete(p.freeQueue);
+        vQueueDelete(p.fullQueue);
+        return 0;
+    }
+    if (xTaskCreatePinnedToCore(pipelineReaderTask, "dl_reader", PIPELINE_STACK, &p, 5, NULL, PIPELINE_READER_CORE) != pdPASS) {
+        Serial.println("✗ Failed to start reader task");
+        // Unblock the writer so it can exit before we tear the queues down
+        xQueueSend(p.fullQueue, &PIPELINE_END, portMAX_DELAY);
+        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+        vQueueDelete(p.freeQueue);
+        vQueueDelete(p.fullQueue);
+        return 0;
     }
-    return resp;
+
+    // Each task notifies us once on exit
+    ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+    ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+
+    if (p.timedOut) Serial.println("\n✗ ERROR: Data stream timed out (Host inactive)");
+    if (p.writeFailed) Serial.println("\n✗ ERROR: Storage write failed (Sink full?)");
+
+    vQueueDelete(p.freeQueue);
+    vQueueDelete(p.fullQueue);
+    Serial.printf("Inline hashing: %lu ms for %ld bytes\n", (unsigned long)(p.hashUs / 1000), (long)p.outputBytes);
+    telemetryAdd(TM_FLASH_WRITE, p.writeUs / 1000);
+    telemetryAdd(TM_WRITE_STALL, p.stallMs);
+    if (ADAPTIVE_CHUNKS) {
+        Serial.printf("Batching: %u B (%u-%u, %lu changes), flush %lu ms, link %.1f KB/s, write %.0f us/KB\n",
+                      (unsigned)chunkCtl.target, (unsigned)chunkCtl.minTarget, (unsigned)chunkCtl.maxTarget,
+                      (unsigned long)chunkCtl.changes, (unsigned long)chunkCtl.flushMs, chunkCtl.rate / 1024.0,
+                      chunkCtl.writeUsPerByte * 1024.0);
+    }
+    *outputBytes = p.outputBytes;
+    return p.bytesWritten;
 }
 
-void printProgress(size_t current, size_t total) {
-    Serial.printf("Downloading: %d%% (%ld B)\n", (int)((current * 100) / total), current);
-}
\ No newline at end of file
+// Drains CellUART into free chunks and hands them to the writer.
+void pipelineReaderTask(void* arg) {
+    DownloadPipeline* p = (DownloadPipeline*)arg;
+
+    while (p->bytesRead < p->fileSize && !p->writeFailed) {
+        uint8_t idx;
+        // Writer holding every chunk this long means storage has stalled
+        uint32_t waitStart = millis();
+        if (xQueueReceive(p->freeQueue, &idx, pdMS_TO_TICKS(INACTIVITY_TIMEOUT)) != pdTRUE) {
+            p->timedOut = true;
+            break;
+        }
+        p->stallMs += millis() - waitStart;
+
+        PipelineChunk& c = p->chunks[idx];
+        // Capped to the remaining file size (prevents reading trailing OK)
+        size_t want = adaptBatch(p);
+        uint32_t flushMs = ADAPTIVE_CHUNKS && chunkCtl.flushMs ? chunkCtl.flushMs : PIPELINE_FLUSH_MS;
+        c.len = 0;
+
+        uint32_t fillStart = micros();
+        unsigned long lastAct = millis();
+        if (p->transport == TRANSPORT_TCP) c.len = pipelineFillFromSocket(p, c, want);
+        if (p->transport == TRANSPORT_UFS) c.len = pipelineFillFromUfs(p, c, want);
+        while (p->transport == TRANSPORT_QHTTP && c.len < want) {
+            int avail = cellLink.available();
+            if (avail > telemetry.maxRxFill) telemetry.maxRxFill = avail;
+            if (avail > 0) {
+                c.len += cellLink.read(c.data + c.len, min((size_t)avail, want - c.len));
+                lastAct = millis();
+                continue;
+            }
+            // Block on the RX event; a short wait once we hold data so a
+            // partial chunk is handed over when the stream pauses
+            if (cellWaitForData(lastAct, c.len > 0 ? flushMs : INACTIVITY_TIMEOUT)) continue;
+            if (c.len > 0) break;
+            p->timedOut = true;
+            break;
+        }
+
+        if (c.len == 0) {
+            xQueueSend(p->freeQueue, &idx, 0);
+            break;
+        }
+        adaptObserve(c.len, micros() - fillStart);
+        p->bytesRead += c.len;
+        xQueueSend(p->fullQueue, &idx, portMAX_DELAY);
+        if (p->timedOut) break;
+    }
+
+    xQueueSend(p->fullQueue, &PIPELINE_END, portMAX_DELAY);
+    xTaskNotifyGive(p->owner);
+    vTaskDelete(NULL);
+}
+
+// Socket transport: asks the modem for at most what the free chunk can take,
+// so the pace is set by how fast the writer recycles chunks. Returns with a
+// partial chunk when the modem has nothing buffered.
+size_t pipelineFillFromSocket(DownloadPipeline* p, PipelineChunk& c, size_t want) {
+    static uint32_t lastStatus = 0;
+    size_t len = takeBodyPending(c.data, want);
+
+    uint32_t lastAct = millis();
+    while (len < want) {
+        int n = tcpRead(p->handle, c.data + len, min((size_t)TCP_READ_MAX, want - len), 5000);
+        if (n < 0) {
+            p->timedOut = true;
+            break;
+        }
+        if (n > 0) {
+            len += n;
+            lastAct = millis();
+            continue;
+        }
+        if (len > 0) break;
+        if ((tcpClosedMask & (1u << p->handle)) || millis() - lastAct > INACTIVITY_TIMEOUT) {
+            p->timedOut = true;
+            break;
+        }
+        // We are in command mode, so a status query can go between reads
+        if (TCP_STATUS_INTERVAL && millis() - lastStatus > TCP_STATUS_INTERVAL) {
+            char csq[32];
+            if (atQuery("AT+CSQ", "+CSQ:", csq, sizeof(csq), 1000)) log_i("%s", csq);
+            lastStatus = millis();
+        }
+        tcpWaitRecv(p->handle, PIPELINE_FLUSH_MS);
+    }
+    return len;
+}
+
+// UFS transport: the whole body is already on the modem, so this is a
+// straight burst of AT+QFREAD blocks at whatever rate the UART runs.
+size_t pipelineFillFromUfs(DownloadPipeline* p, PipelineChunk& c, size_t want) {
+    size_t len = takeBodyPending(c.data, want);
+    while (len < want) {
+        int n = ufsRead(p->handle, c.data + len, min((size_t)UFS_READ_MAX, want - len));
+        if (n <= 0) {
+            p->timedOut = true;  // Body on the modem is shorter than Content-Length
+            break;
+        }
+        len += n;
+    }
+    return len;
+}
+
+// Moves up to want bytes read ahead with the response headers into out.
+size_t takeBodyPending(uint8_t* out, size_t want) {
+    size_t len = min(bodyPendingLen, want);
+    memcpy(out, bodyPending, len);
+    memmove(bodyPending, bodyPending + len, bodyPendingLen - len);
+    bodyPendingLen -= len;
+    return len;
+}
+
+// Writes filled chunks to storage (through the inflater if there is one),
+// folds them into the digest and recycles them back to the reader.
+void pipelineWriterTask(void* arg) {
+    DownloadPipeline* p = (DownloadPipeline*)arg;
+
+    while (true) {
+        uint8_t idx;
+        bool got = xQueueReceive(p->fullQueue, &idx, 0) == pdTRUE;
+        // Gaps between chunks go to erasing ahead, so SINK_RAW writes find
+        // their sector already clean
+        while (!got && !p->writeFailed && rawEraseAhead(*p->sink)) got = xQueueReceive(p->fullQueue, &idx, 0) == pdTRUE;
+        if (!got) xQueueReceive(p->fullQueue, &idx, portMAX_DELAY);
+        if (idx == PIPELINE_END) break;
+
+        PipelineChunk& c = p->chunks[idx];
+        if (!p->writeFailed) {
+            uint32_t w0 = micros();
+            bool ok = p->inflater ? gzipFeed(*p->inflater, pipelineEmit, p, c.data, c.len)
+                                  : pipelineEmit(p, c.data, c.len);
+            if (!ok && p->inflater && p->inflater->error) Serial.printf("✗ %s\n", p->inflater->error);
+            adaptWriteCost(c.len, micros() - w0);
+            if (!ok) {
+                p->writeFailed = true;
+            } else {
+                long before = p->baseOffset + p->bytesWritten;
+                p->bytesWritten += c.len;
+                long stored = p->baseOffset + p->bytesWritten;
+                if (before / 51200 != stored / 51200) printProgress(stored, p->totalSize);
+                downloaderProgress(stored, p->totalSize);
+            }
+        }
+        xQueueSend(p->freeQueue, &idx, portMAX_DELAY);
+    }
+
+    xTaskNotifyGive(p->owner);
+    vTaskDelete(NULL);
+}
+
+// Next reader batch: the controller's target, trimmed so the batch ends on
+// a CHUNK_SIZE boundary of the image (whole flash sectors per write).
+size_t adaptBatch(DownloadPipeline* p) {
+    size_t remaining = (size_t)(p->fileSize - p->bytesRead);
+    size_t want = bufferPool.chunkSize;
+    if (ADAPTIVE_CHUNKS) {
+        if (chunkCtl.target == 0) {
+            chunkCtl.target = CHUNK_SIZE;
+            chunkCtl.minTarget = chunkCtl.maxTarget = CHUNK_SIZE;
+        }
+        want = min(chunkCtl.target, bufferPool.chunkSize);
+        long pos = p->baseOffset + p->bytesRead;
+        if (want >= CHUNK_SIZE) want -= pos % CHUNK_SIZE;
+    }
+    return min(want, remaining);
+}
+
+// Reader side: one batch of len bytes took fillUs to arrive.
+void adaptObserve(size_t len, uint32_t fillUs) {
+    if (!ADAPTIVE_CHUNKS || fillUs == 0) return;
+    float sample = len * 1000000.0f / fillUs;
+    chunkCtl.rate = chunkCtl.rate > 0 ? chunkCtl.rate * 0.75f + sample * 0.25f : sample;
+
+    size_t cap = bufferPool.chunkSize;
+    size_t target;
+    if (chunkCtl.writeUsPerByte * chunkCtl.rate / 1000000.0f > ADAPT_WRITER_BUSY) {
+        target = cap;
+    } else {
+        size_t bytes = (size_t)(chunkCtl.rate * ADAPT_BATCH_MS / 1000);
+        target = (bytes + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE;
+        target = max((size_t)CHUNK_SIZE, min(target, cap));
+    }
+    // Wait up to half a sector's arrival time for the rest of a batch
+    uint32_t flush = (uint32_t)(CHUNK_SIZE * 500.0f / chunkCtl.rate);
+    chunkCtl.flushMs = max((uint32_t)PIPELINE_FLUSH_MS, min(flush, (uint32_t)ADAPT_FLUSH_MAX_MS));
+
+    if (target != chunkCtl.target) {
+        chunkCtl.target = target;
+        chunkCtl.changes++;
+        chunkCtl.minTarget = min(chunkCtl.minTarget, target);
+        chunkCtl.maxTarget = max(chunkCtl.maxTarget, target);
+    }
+}
+
+// Writer side: handling len bytes took us.
+void adaptWriteCost(size_t len, uint32_t us) {
+    if (!ADAPTIVE_CHUNKS || len == 0) return;
+    chunkCtl.maxWriteUs = max(chunkCtl.maxWriteUs, us);
+    float sample = (float)us / len;
+    chunkCtl.writeUsPerByte = chunkCtl.writeUsPerByte > 0 ? chunkCtl.writeUsPerByte * 0.75f + sample * 0.25f : sample;
+}
+
+// Output of the (optional) inflater: a patch stream or the image itself.
+// ctx is the DownloadPipeline.
+bool pipelineEmit(void* ctx, const uint8_t* data, size_t len) {
+    DownloadPipeline* p = (DownloadPipeline*)ctx;
+    if (p->patcher) {
+        bool ok = deltaFeed(*p->patcher, pipelineStore, p, data, len);
+        if (!ok && p->patcher->error) Serial.printf("✗ %s\n", p->patcher->error);
+        return ok;
+    }
+    return pipelineStore(p, data, len);
+}
+
+// Final stage of the writer: stores image bytes and hashes them.
+bool pipelineStore(void* ctx, const uint8_t* data, size_t len) {
+    DownloadPipeline* p = (DownloadPipeline*)ctx;
+    uint32_t w0 = micros();
+    bool written = sinkWrite(*p->sink, data, len);
+    p->writeUs += micros() - w0;
+    if (!written) return false;
+    uint32_t t0 = micros();
+    hashUpdate(*p->hash, data, len);
+    p->hashUs += micros() - t0;
+    p->outputBytes += len;
+    return true;
+}
+
+// ============================================================================
+// STREAMING DECOMPRESSION
+// ============================================================================
+
+// Resets the (lazily allocated, then reused) gzip decoder for a new stream.
+GzipInflater* gzipBegin() {
+    if (gzipInflater == NULL) {
+        gzipInflater = (GzipInflater*)heap_caps_malloc(sizeof(GzipInflater), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (gzipInflater == NULL) {
+            Serial.println("✗ Memory Allocation Failed (inflater)");
+            return NULL;
+        }
+    }
+    gzipInit(*gzipInflater);
+    return gzipInflater;
+}
+
+// ============================================================================
+// SEGMENTED DOWNLOAD
+// ============================================================================
+
+// Sends a HEAD for url over socket TCP_FIRST_ID and parses the response
+// headers into head. False if the request or the socket failed.
+bool httpHead(const String& url, HttpHeaderParser& head) {
+    String hostPort, path, host;
+    uint16_t port;
+    bool tls = urlIsHttps(url);
+    httpHeaderBegin(head);
+    if (!splitUrl(url, hostPort, path) || !splitHostPort(hostPort, host, port, tls ? 443 : 80)) return false;
+    atOnUrc("+QIURC:", tcpOnUrc);
+    atOnUrc("+QSSLURC:", tcpOnUrc);
+    if (!bufferPoolInit()) return false;
+    uint8_t* buf = bufferPool.bounce;
+
+    tcpClosedMask &= ~(1u << TCP_FIRST_ID);
+    String request = "HEAD " + path + " HTTP/1.1\r\nHost: " + hostPort + "\r\nConnection: close\r\n\r\n";
+    bool ok = tcpOpen(TCP_FIRST_ID, host, port, tls) && tcpSend(TCP_FIRST_ID, request.c_str(), request.length());
+    uint32_t start = millis();
+    while (ok && !head.done) {
+        int n = tcpRead(TCP_FIRST_ID, buf, TCP_READ_MAX, 5000);
+        if (n < 0 || millis() - start > 30000) ok = false;
+        else if (n > 0) httpHeaderFeed(head, buf, n);
+        else if (tcpClosedMask & (1u << TCP_FIRST_ID)) ok = false;
+        else atWaitFor(NULL, 100, false);
+    }
+    tcpClose(TCP_FIRST_ID);
+    lastHttpStatus = head.status;
+    return ok;
+}
+
+// A patched file has no validators of its own. HEADs the full image at url
+// and keeps its ETag / Last-Modified for path, so the next check is a
+// conditional GET again. Skipped if the server's length is not what we hold.
+void refreshValidators(const String& url, const char* path) {
+    HttpHeaderParser head;
+    File f = STAGING_FS.open(path, FILE_READ);
+    long stored = f ? (long)f.size() : -1;
+    if (f) f.close();
+    if (!httpHead(url, head) || head.status != 200 || head.contentLength != stored) {
+        Serial.println("Could not confirm the patched file against the server; next check downloads it in full");
+        return;
+    }
+    saveValidators(path, head.validators);
+}
+
+// HEADs url, then splits the body into DOWNLOAD_SEGMENTS ranges fetched over
+// their own sockets. The modem buffers every connection's TCP stream at once;
+// we pull from each in turn with AT+QIRD and write at the segment's offset.
+// OTA writes land in place; other sinks stage segments in "<path>.<n>" files
+// and concatenate them at the end, so the filesystem needs room for the image.
+bool segmentedDownload(const String& url, const DownloadOptions& opts) {
+    String hostPort, path, host;
+    uint16_t port;
+    bool tls = urlIsHttps(url);
+    if (!splitUrl(url, hostPort, path) || !splitHostPort(hostPort, host, port, tls ? 443 : 80)) return false;
+    atOnUrc("+QIURC:", tcpOnUrc);
+    atOnUrc("+QSSLURC:", tcpOnUrc);
+
+    if (!bufferPoolInit()) return false;
+    uint8_t* buf = bufferPool.bounce;
+    String request;
+
+    // 1. Size, range support and validators from a HEAD
+    HttpHeaderParser head;
+    bool headOk = httpHead(url, head);
+    if (!headOk || head.status != 200 || head.contentLength <= 0) {
+        Serial.printf("✗ HEAD failed (HTTP %d)\n", head.status);
+        return false;
+    }
+    long totalSize = head.contentLength;
+    if (!head.acceptRanges || totalSize < SEGMENT_MIN_SIZE) {
+        Serial.println("Server does not take ranges or file is small; not splitting");
+        return false;
+    }
+
+    HttpValidators cached;
+    if (opts.sink == SINK_FILE && STAGING_FS.exists(opts.path) && loadValidators(opts.path, cached) &&
+        ((cached.etag[0] && strcmp(cached.etag, head.validators.etag) == 0) ||
+         (!cached.etag[0] && cached.lastModified[0] && strcmp(cached.lastModified, head.validators.lastModified) == 0))) {
+        Serial.println("✓ Not modified since last download - keeping stored copy");
+        return true;
+    }
+
+    // 2. Open every range. Their responses queue up in the modem meanwhile.
+    int count = min(DOWNLOAD_SEGMENTS, SEGMENT_MAX);
+    static DownloadSegment segs[SEGMENT_MAX];
+    long segSize = (totalSize + count - 1) / count;
+    StorageSink sink;
+    if (opts.sink == SINK_OTA && !sinkBegin(sink, SINK_OTA, opts.path, totalSize, 0)) return false;
+
+    bool ok = true;
+    int opened = 0;
+    for (; opened < count && ok; opened++) {
+        DownloadSegment& s = segs[opened];
+        s.id = TCP_FIRST_ID + opened;
+        s.start = opened * segSize;
+        s.end = min(totalSize, s.start + segSize) - 1;
+        s.pos = s.start;
+        s.done = false;
+        httpHeaderBegin(s.hdr);
+        tcpClosedMask &= ~(1u << s.id);
+        if (opts.sink != SINK_OTA) {
+            snprintf(s.partPath, sizeof(s.partPath), "%s.%d", opts.path, opened);
+            if (!sinkBegin(s.part, SINK_FILE, s.partPath, 0, 0)) {
+                ok = false;
+                break;
+            }
+        }
+        request = "GET " + path + " HTTP/1.1\r\nHost: " + hostPort + "\r\nRange: bytes=" +
+                  String(s.start) + "-" + String(s.end) + "\r\nConnection: close\r\n\r\n";
+        ok = tcpOpen(s.id, host, port, tls) && tcpSend(s.id, request.c_str(), request.length());
+    }
+    if (ok) Serial.printf("✓ %d segments of %ld bytes in flight\n", count, segSize);
+
+    // 3. Round-robin pull until every range is complete
+    uint32_t startTime = millis();
+    uint32_t lastAct = startTime;
+    long received = 0;
+    int remaining = count;
+    while (ok && remaining > 0) {
+        bool any = false;
+        for (int i = 0; i < count && ok; i++) {
+            DownloadSegment& s = segs[i];
+            if (s.done) continue;
+            int n = tcpRead(s.id, buf, TCP_READ_MAX, 5000);
+            if (n < 0) {
+                ok = false;
+                break;
+            }
+            if (n == 0) {
+                if (tcpClosedMask & (1u << s.id)) {
+                    Serial.printf("✗ Segment %d closed at %ld / %ld\n", i, s.pos - s.start, s.end - s.start + 1);
+                    ok = false;
+                }
+                continue;
+            }
+            any = true;
+
+            size_t used = s.hdr.done ? 0 : httpHeaderFeed(s.hdr, buf, n);
+            if (!s.hdr.done) continue;
+            if (s.hdr.status != 206) {
+                Serial.printf("✗ Segment %d: HTTP %d instead of 206\n", i, s.hdr.status);
+                ok = false;
+                break;
+            }
+            size_t len = min((size_t)(n - used), (size_t)(s.end + 1 - s.pos));
+            bool written = opts.sink == SINK_OTA ? sinkWriteAt(sink, s.pos, buf + used, len)
+                                                 : sinkWrite(s.part, buf + used, len);
+            if (!written) {
+                Serial.println("✗ Flash Write Failed");
+                ok = false;
+                break;
+            }
+            if (received / 51200 != (received + (long)len) / 51200) printProgress(received + len, totalSize);
+            downloaderProgress(received + len, totalSize);
+            s.pos += len;
+            received += len;
+            if (s.pos > s.end) {
+                s.done = true;
+                remaining--;
+                tcpClose(s.id);
+            }
+        }
+        if (any) {
+            lastAct = millis();
+        } else if (millis() - lastAct > INACTIVITY_TIMEOUT) {
+            Serial.println("✗ Timeout: No data received from modem.");
+            ok = false;
+        } else {
+            atWaitFor(NULL, 50, false);  // Let "recv"/"closed" URCs through
+        }
+    }
+    for (int i = 0; i < opened; i++) {
+        if (!segs[i].done) tcpClose(segs[i].id);
+    }
+
+    uint32_t elapsed = millis() - startTime;
+    telemetryAdd(TM_TRANSFER, elapsed);
+    downloaderEnter(DL_VERIFYING);
+    telemetry.bytes += received;
+    if (ok) Serial.printf("✓ %ld bytes over %d sockets in %lu ms (%lu B/s)\n", received, count,
+                          (unsigned long)elapsed, elapsed ? (unsigned long)(received * 1000ULL / elapsed) : 0);
+
+    // 4. Assemble (SPIFFS) and hash the stored image
+    uint8_t digest[HASH_MAX_LEN];
+    if (opts.sink == SINK_OTA) {
+        if (!ok || !partitionDigest(sink.partition, totalSize, opts.hash, digest)) {
+            sinkEnd(sink, false);
+            return false;
+        }
+    } else {
+        for (int i = 0; i < opened; i++) sinkEnd(segs[i].part, true);
+        bool sinkOpen = ok && sinkBegin(sink, opts.sink, opts.path, totalSize, 0);
+        ok = sinkOpen;
+        StreamHash hash;
+        hashBegin(hash, opts.hash);
+        for (int i = 0; i < opened && ok; i++) {
+            File f = STAGING_FS.open(segs[i].partPath, FILE_READ);
+            while (ok && f && f.available()) {
+                int n = f.read(buf, CHUNK_SIZE);
+                if (n <= 0) break;
+                ok = sinkWrite(sink, buf, n);
+                hashUpdate(hash, buf, n);
+            }
+            if (f) f.close();
+        }
+        hashFinish(hash, digest);
+        for (int i = 0; i < opened; i++) STAGING_FS.remove(segs[i].partPath);
+        if (!ok) {
+            if (sinkOpen) sinkEnd(sink, false);
+            return false;
+        }
+    }
+
+    return finishDownload(sink, opts, digest, totalSize, opts.path, NULL, head.validators);
+}
+
+// ============================================================================
+// TLS
+// ============================================================================
+
+static bool sslCfg(const char* name, const char* value) {
+    char cmd[80];
+    snprintf(cmd, sizeof(cmd), "AT+QSSLCFG=\"%s\",%d,%s", name, TLS_CTX_ID, value);
+    return sendAT(cmd, "OK", 2000);
+}
+
+// Sets up TLS_CTX_ID once per power-up. Session caching lets every later
+// connection on the context (QHTTP and QSSLOPEN alike) resume the last
+// session instead of paying for a full handshake over cellular RTTs.
+bool tlsConfigure() {
+    if (tlsReady) return true;
+    if (!sslCfg("sslversion", "4") || !sslCfg("ciphersuite", "0xFFFF")) {
+        Serial.println("✗ TLS context configuration failed");
+        return false;
+    }
+    sslCfg("sni", "1");  // Virtual-hosted buckets need SNI
+
+    if (*TLS_CA_CERT) {
+        if (!tlsUploadCa() || !sslCfg("cacert", "\"" TLS_CA_FILE "\"") || !sslCfg("seclevel", "1")) {
+            Serial.println("✗ Could not install TLS CA");
+            return false;
+        }
+        sslCfg("ignorelocaltime", "1");  // Modem clock may not be set yet
+    } else if (TLS_ALLOW_UNVERIFIED) {
+        sslCfg("seclevel", "0");
+        Serial.println("⚠ TLS_CA_CERT empty: server certificate is not verified");
+    } else {
+        Serial.println("✗ TLS_CA_CERT empty: refusing https:// (set TLS_ALLOW_UNVERIFIED to override)");
+        return false;
+    }
+
+    if (!sslCfg("session_cache", "1")) {
+        Serial.println("  (Modem has no TLS session cache; each connection does a full handshake)");
+    }
+    tlsReady = true;
+    return true;
+}
+
+// Uploads TLS_CA_CERT to TLS_CA_FILE unless the copy there is the one we
+// uploaded last (CRC kept in TLS_CA_CRC_PATH).
+bool tlsUploadCa() {
+    size_t len = strlen(TLS_CA_CERT);
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)TLS_CA_CERT, len);
+
+    uint32_t stored = 0;
+    File f = STAGING_FS.open(TLS_CA_CRC_PATH, FILE_READ);
+    if (f) {
+        f.read((uint8_t*)&stored, sizeof(stored));
+        f.close();
+    }
+    char line[64];
+    if (stored == crc && atQuery("AT+QFLST=\"" TLS_CA_FILE "\"", "+QFLST:", line, sizeof(line), 2000)) return true;
+
+    sendAT("AT+QFDEL=\"" TLS_CA_FILE "\"", "OK", 2000);
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "AT+QFUPL=\"%s\",%u,10", TLS_CA_FILE, (unsigned)len);
+    cellLink.println(cmd);
+    if (!waitForResponse("CONNECT", 5000)) return false;
+    cellLink.write((const uint8_t*)TLS_CA_CERT, len);
+    if (atWaitFor("+QFUPL:", 15000, true) != AT_MATCH) return false;
+    atWaitFor(NULL, 1000, true);
+
+    f = STAGING_FS.open(TLS_CA_CRC_PATH, FILE_WRITE);
+    if (f) {
+        f.write((const uint8_t*)&crc, sizeof(crc));
+        f.close();
+    }
+    Serial.println("✓ TLS CA uploaded to modem");
+    return true;
+}
+
+// ============================================================================
+// TCP SOCKETS
+// ============================================================================
+
+// Splits "host[:port]" as returned by splitUrl().
+bool splitHostPort(const String& hostPort, String& host, uint16_t& port, uint16_t defaultPort) {
+    int colon = hostPort.indexOf(':');
+    host = colon == -1 ? hostPort : hostPort.substring(0, colon);
+    port = colon == -1 ? defaultPort : (uint16_t)hostPort.substring(colon + 1).toInt();
+    return host.length() > 0 && port != 0;
+}
+
+bool urlIsHttps(const String& url) {
+    return url.startsWith("https://");
+}
+
+// Opens connectID id in buffer access mode on PDP context 1; received data
+// waits in the modem until we AT+QIRD (AT+QSSLRECV with tls) it.
+bool tcpOpen(int id, const String& host, uint16_t port, bool tls) {
+    if (tls && !tlsConfigure()) return false;
+    char cmd[160];
+    if (tls) {
+        snprintf(cmd, sizeof(cmd), "AT+QSSLOPEN=1,%d,%d,\"%s\",%u,0", TLS_CTX_ID, id, host.c_str(), port);
+    } else {
+        snprintf(cmd, sizeof(cmd), "AT+QIOPEN=1,%d,\"TCP\",\"%s\",%u,0,0", id, host.c_str(), port);
+    }
+    if (!sendAT(cmd, "OK", 5000)) return false;
+
+    // The TLS handshake happens before this result arrives
+    char prefix[20];
+    snprintf(prefix, sizeof(prefix), tls ? "+QSSLOPEN: %d," : "+QIOPEN: %d,", id);
+    if (atWaitFor(prefix, 150000, false) != AT_MATCH) {
+        Serial.printf("✗ Socket %d: no open result\n", id);
+        return false;
+    }
+    int err = atoi(atChannel.parser.line + strlen(prefix));
+    if (err != 0) {
+        Serial.printf("✗ Socket %d open failed: %s\n", id, atChannel.parser.line);
+        return false;
+    }
+    tcpClosedMask &= ~(1u << id);
+    if (tls) tcpTlsMask |= 1u << id;
+    else tcpTlsMask &= ~(1u << id);
+    return true;
+}
+
+void tcpClose(int id) {
+    char cmd[24];
+    snprintf(cmd, sizeof(cmd), (tcpTlsMask & (1u << id)) ? "AT+QSSLCLOSE=%d" : "AT+QICLOSE=%d", id);
+    sendAT(cmd, "OK", 10000);
+}
+
+// Blocks until the modem reports new data on id or timeout ms pass; URCs for
+// other sockets (e.g. "closed") are dispatched meanwhile.
+void tcpWaitRecv(int id, uint32_t timeout) {
+    atWaitFor((tcpTlsMask & (1u << id)) ? "+QSSLURC: \"recv\"" : "+QIURC: \"recv\"", timeout, false);
+}
+
+bool tcpSend(int id, const char* data, size_t len) {
+    char cmd[32];
+    snprintf(cmd, sizeof(cmd), (tcpTlsMask & (1u << id)) ? "AT+QSSLSEND=%d,%u" : "AT+QISEND=%d,%u", id, (unsigned)len);
+    cellLink.println(cmd);
+    if (!atWaitPrompt(5000)) {
+        Serial.printf("✗ Socket %d: no send prompt\n", id);
+        return false;
+    }
+    cellLink.write((const uint8_t*)data, len);
+    return waitForResponse("SEND OK", 10000);
+}
+
+// Pulls up to maxLen buffered bytes of connectID id. Returns the count (0 when
+// nothing is waiting) or -1 on error.
+int tcpRead(int id, uint8_t* buf, size_t maxLen, uint32_t timeout) {
+    bool tls = tcpTlsMask & (1u << id);
+    const char* prefix = tls ? "+QSSLRECV: " : "+QIRD: ";
+    char cmd[32];
+    snprintf(cmd, sizeof(cmd), tls ? "AT+QSSLRECV=%d,%u" : "AT+QIRD=%d,%u", id, (unsigned)maxLen);
+    cellLink.println(cmd);
+    if (atWaitFor(prefix, timeout, true) != AT_MATCH) return -1;
+
+    // "+QIRD: <n>\r\n" then exactly n data bytes, then OK
+    int n = atoi(strstr(atChannel.parser.line, prefix) + strlen(prefix));
+    if (n < 0 || (size_t)n > maxLen) return -1;
+    int got = 0;
+    uint32_t start = millis();
+    while (got < n && cellWaitForData(start, timeout)) {
+        got += cellLink.read(buf + got, n - got);
+    }
+    if (got < n) return -1;
+    atWaitFor(NULL, 1000, true);
+    return n;
+}
+
+// GET over our own socket: sends the request, then pulls until the header
+// block is complete. Body bytes that came with it wait in bodyPending for the
+// pipeline. The socket stays open on 200/206 and is closed otherwise.
+bool tcpHttpGet(const String& url, const String& extraHeaders, int id, int& status, long& length, HttpValidators& v) {
+    String hostPort, path, host;
+    uint16_t port;
+    bool tls = urlIsHttps(url);
+    if (!splitUrl(url, hostPort, path) || !splitHostPort(hostPort, host, port, tls ? 443 : 80)) {
+        Serial.println("✗ Error: Cannot parse URL");
+        return false;
+    }
+    atOnUrc("+QIURC:", tcpOnUrc);
+    atOnUrc("+QSSLURC:", tcpOnUrc);
+    tcpClose(id);  // A socket left over from an aborted attempt
+
+    String request = "GET " + path + " HTTP/1.1\r\nHost: " + hostPort + "\r\n" + extraHeaders +
+                     "Connection: close\r\n\r\n";
+    if (!tcpOpen(id, host, port, tls) || !tcpSend(id, request.c_str(), request.length())) {
+        tcpClose(id);
+        return false;
+    }
+
+    HttpHeaderParser h;
+    httpHeaderBegin(h);
+    bodyPendingLen = 0;
+    uint32_t start = millis();
+    while (!h.done) {
+        int n = tcpRead(id, bodyPending, sizeof(bodyPending), 5000);
+        if (n < 0 || millis() - start > 80000 || (n == 0 && (tcpClosedMask & (1u << id)))) {
+            Serial.println("✗ No HTTP response on socket");
+            tcpClose(id);
+            return false;
+        }
+        if (n == 0) {
+            tcpWaitRecv(id, 500);
+            continue;
+        }
+        size_t used = httpHeaderFeed(h, bodyPending, n);
+        if (h.done) {
+            bodyPendingLen = n - used;
+            memmove(bodyPending, bodyPending + used, bodyPendingLen);
+        }
+    }
+
+    status = h.status;
+    length = h.contentLength;
+    v = h.validators;
+    lastHttpStatus = status;
+    if (status != 200 && status != 206) tcpClose(id);
+    return status != 0;
+}
+
+void tcpOnUrc(const char* line) {
+    int id;
+    if ((sscanf(line, "+QIURC: \"closed\",%d", &id) == 1 || sscanf(line, "+QSSLURC: \"closed\",%d", &id) == 1) &&
+        id >= 0 && id < 32) tcpClosedMask |= 1u << id;
+    // "recv" only says data is waiting; the readers poll anyway
+}
+
+// Waits for the "> " data prompt, which comes without a line ending.
+bool atWaitPrompt(uint32_t timeout) {
+    uint32_t start = millis();
+    while (cellWaitForData(start, timeout)) {
+        while (cellLink.available()) {
+            char c = (char)cellLink.read();
+            if (c == '>' && atChannel.parser.len == 0) return true;
+            if (!atFeed(atChannel.parser, c)) continue;
+            AtLineKind kind = atClassify(atChannel.parser.line);
+            if (kind == AT_LINE_ERROR) return false;
+            if (kind == AT_LINE_URC) atDispatchUrc(atChannel.parser.line);
+        }
+    }
+    return false;
+}
+
+// ============================================================================
+// MODEM UFS STAGING
+// ============================================================================
+
+static long ufsFilePos = 0;  // Read position in the open UFS file
+
+// Clears any stale staging file and checks the modem has room for size bytes
+// plus the response headers stored in front of them.
+bool ufsHasRoom(long size) {
+    sendAT("AT+QFDEL=\"" UFS_FILE "\"", "OK", 2000);
+    char line[64];
+    if (!atQuery("AT+QFLDS=\"UFS\"", "+QFLDS:", line, sizeof(line), 2000)) return false;
+    long freeBytes = 0;
+    sscanf(line, "+QFLDS: %ld", &freeBytes);
+    return freeBytes > size + HTTP_HEADER_MAX;
+}
+
+// Has the modem write the pending GET response into UFS_FILE. Returns once
+// the radio side is finished; nothing crosses the UART meanwhile.
+bool ufsStoreBody() {
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "AT+QHTTPREADFILE=\"%s\",%d", UFS_FILE, UFS_FETCH_TIMEOUT);
+    if (!sendAT(cmd, "OK", 5000)) return false;
+
+    uint32_t start = millis();
+    if (atWaitFor("+QHTTPREADFILE: ", (UFS_FETCH_TIMEOUT + 10) * 1000UL, false) != AT_MATCH) {
+        Serial.println("✗ Modem did not finish storing the body");
+        return false;
+    }
+    int err = atoi(atChannel.parser.line + 16);
+    if (err != 0) {
+        Serial.printf("✗ HTTP read to UFS failed: %s\n", atChannel.parser.line);
+        return false;
+    }
+    Serial.printf("✓ Body stored on modem in %lu ms\n", (unsigned long)(millis() - start));
+    return true;
+}
+
+// Opens UFS_FILE and reads past the response header block ("responseheader"
+// mode stores it too). Returns the file handle, or -1.
+int ufsOpenBody(HttpValidators& v) {
+    char line[48];
+    if (!atQuery("AT+QFOPEN=\"" UFS_FILE "\",2", "+QFOPEN:", line, sizeof(line), 2000)) {
+        Serial.println("✗ Cannot open UFS staging file");
+        return -1;
+    }
+    int fh = atoi(line + 8);
+    ufsFilePos = 0;
+
+    HttpHeaderParser h;
+    httpHeaderBegin(h);
+    bodyPendingLen = 0;
+    while (!h.done) {
+        int n = ufsRead(fh, bodyPending, sizeof(bodyPending));
+        if (n <= 0) {
+            ufsClose(fh);
+            return -1;
+        }
+        size_t used = httpHeaderFeed(h, bodyPending, n);
+        if (h.done) {
+            bodyPendingLen = n - used;
+            memmove(bodyPending, bodyPending + used, bodyPendingLen);
+        }
+    }
+    v = h.validators;
+    return fh;
+}
+
+// One AT+QFREAD block: "CONNECT <n>", n raw bytes, "OK". The modem offers no
+// checksum for it, so the framing is the check - a short block or a missing
+// OK is re-read from the same offset after AT+QFSEEK.
+int ufsRead(int fh, uint8_t* buf, size_t len) {
+    char cmd[40];
+    for (int attempt = 0; attempt < UFS_READ_RETRIES; attempt++) {
+        if (attempt > 0) {
+            Serial.printf("Re-reading UFS block @ %ld\n", ufsFilePos);
+            drainModem(50, 1000);
+            snprintf(cmd, sizeof(cmd), "AT+QFSEEK=%d,%ld,0", fh, ufsFilePos);
+            if (!sendAT(cmd, "OK", 2000)) continue;
+        }
+        snprintf(cmd, sizeof(cmd), "AT+QFREAD=%d,%u", fh, (unsigned)len);
+        cellLink.println(cmd);
+        if (atWaitFor("CONNECT", 5000, true) != AT_MATCH) continue;
+
+        int n = atoi(atChannel.parser.line + 7);
+        if (n < 0 || (size_t)n > len) continue;
+        int got = 0;
+        uint32_t start = millis();
+        while (got < n && cellWaitForData(start, 5000)) {
+            got += cellLink.read(buf + got, n - got);
+        }
+        if (got != n || atWaitFor(NULL, 1000, true) != AT_OK) continue;
+        ufsFilePos += n;
+        return n;
+    }
+    return -1;
+}
+
+void ufsClose(int fh) {
+    if (fh >= 0) {
+        char cmd[24];
+        snprintf(cmd, sizeof(cmd), "AT+QFCLOSE=%d", fh);
+        sendAT(cmd, "OK", 2000);
+    }
+    sendAT("AT+QFDEL=\"" UFS_FILE "\"", "OK", 2000);
+}
+
+// ============================================================================
+// DELTA UPDATES
+// ============================================================================
+
+// Length of the app image in part as it was flashed: the .bin file, its
+// appended SHA-256 included. -1 if part holds no valid image.
+long appImageLength(const esp_partition_t* part) {
+    esp_partition_pos_t pos = { part->address, part->size };
+    esp_image_metadata_t meta;
+    if (esp_image_get_metadata(&pos, &meta) != ESP_OK) return -1;
+    return meta.image_len;
+}
+
+// SHA-256 that names the patch we can apply: of the stored file, or of the
+// running image's bytes for OTA. Both hash the whole .bin, as mkpatch.py
+// does; esp_partition_get_sha256() would give the appended digest, which
+// leaves out the last 32 bytes.
+bool deltaBaseDigest(DownloadSink sink, const char* path, uint8_t* out) {
+    if (sink == SINK_RAW) return false;  // Raw staging keeps no base to patch
+    if (sink == SINK_OTA) {
+        const esp_partition_t* running = esp_ota_get_running_partition();
+        long len = appImageLength(running);
+        return len > 0 && partitionDigest(running, len, HASH_SHA256, out);
+    }
+    if (!STAGING_FS.exists(path)) return false;
+    return storedFileDigest(path, HASH_SHA256, out);
+}
+
+static bool deltaReadPartition(void* ctx, long pos, uint8_t* out, size_t len) {
+    return esp_partition_read((const esp_partition_t*)ctx, pos, out, len) == ESP_OK;
+}
+
+static bool deltaReadFile(void* ctx, long pos, uint8_t* out, size_t len) {
+    File& f = *(File*)ctx;
+    return f.seek(pos) && f.read(out, len) == len;
+}
+
+DeltaPatcher* deltaBegin(DownloadSink sink, const char* basePath) {
+    if (!bufferPoolInit()) return NULL;
+    DeltaPatcher& d = deltaPatcher;
+    if (sink == SINK_OTA) {
+        // Bounded by the image, so a patch cannot copy erased flash past it
+        deltaBasePart = esp_ota_get_running_partition();
+        long len = appImageLength(deltaBasePart);
+        if (len <= 0) {
+            Serial.println("✗ No valid running image to patch");
+            return NULL;
+        }
+        deltaInit(d, deltaReadPartition, (void*)deltaBasePart, len, bufferPool.bounce, CHUNK_SIZE);
+    } else {
+        deltaBaseFile = STAGING_FS.open(basePath, FILE_READ);
+        if (!deltaBaseFile) {
+            Serial.println("✗ Cannot open patch base");
+            return NULL;
+        }
+        deltaInit(d, deltaReadFile, &deltaBaseFile, deltaBaseFile.size(), bufferPool.bounce, CHUNK_SIZE);
+    }
+    return &d;
+}
+
+void deltaEnd(DeltaPatcher& d) {
+    if (deltaBaseFile) deltaBaseFile.close();
+}
+
+// ============================================================================
+// BUFFER POOL
+// ============================================================================
+
+// Allocates the pool on first use; later calls are free. Falls back to
+// CHUNK_SIZE chunks in internal RAM when the board has no PSRAM.
+bool bufferPoolInit() {
+    if (bufferPool.ready) return true;
+
+    bufferPool.bounce = (uint8_t*)heap_caps_malloc(CHUNK_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+    bufferPool.sector = (uint8_t*)heap_caps_malloc(CHUNK_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+    if (bufferPool.bounce == NULL || bufferPool.sector == NULL) {
+        Serial.println("✗ Memory Allocation Failed (bounce buffer)");
+        heap_caps_free(bufferPool.bounce);
+        heap_caps_free(bufferPool.sector);
+        bufferPool.bounce = bufferPool.sector = NULL;
+        return false;
+    }
+
+    bufferPool.psram = psramFound();
+    bufferPool.chunkSize = bufferPool.psram ? POOL_CHUNK_SIZE : CHUNK_SIZE;
+    uint32_t caps = bufferPool.psram ? MALLOC_CAP_SPIRAM : (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+    for (int i = 0; i < PIPELINE_CHUNKS; i++) {
+        bufferPool.chunks[i] = (uint8_t*)heap_caps_malloc(bufferPool.chunkSize, caps);
+        if (bufferPool.chunks[i] == NULL) {
+            Serial.println("✗ Memory Allocation Failed (buffer pool)");
+            while (--i >= 0) heap_caps_free(bufferPool.chunks[i]);
+            heap_caps_free(bufferPool.bounce);
+            heap_caps_free(bufferPool.sector);
+            bufferPool.bounce = bufferPool.sector = NULL;
+            return false;
+        }
+    }
+
+    bufferPool.ready = true;
+    Serial.printf("✓ Buffer pool: %d x %u KB in %s\n", PIPELINE_CHUNKS,
+                  (unsigned)(bufferPool.chunkSize / 1024), bufferPool.psram ? "PSRAM" : "internal RAM");
+    return true;
+}
+
+// ============================================================================
+// STORAGE SINKS
+// ============================================================================
+
+// resumeOffset > 0 appends to an existing partial file at path (SPIFFS only).
+bool sinkBegin(StorageSink& sink, DownloadSink kind, const char* path, long size, long resumeOffset) {
+    sink.kind = kind;
+    sink.path = path;
+    sink.partition = NULL;
+    sink.ota = 0;
+
+    if (kind == SINK_OTA) {
+        sink.partition = esp_ota_get_next_update_partition(NULL);
+        if (sink.partition == NULL) {
+            Serial.println("✗ No OTA partition available");
+            return false;
+        }
+        if (size > 0 && (size_t)size > sink.partition->size) {
+            Serial.printf("✗ Image too large for %s (%ld > %u bytes)\n", sink.partition->label, size, sink.partition->size);
+            return false;
+        }
+        // Erase the whole image region now, before the modem starts streaming;
+        // with no known size, erase sector by sector as we go instead
+        esp_err_t err = esp_ota_begin(sink.partition, size > 0 ? size : OTA_WITH_SEQUENTIAL_WRITES, &sink.ota);
+        if (err != ESP_OK) {
+            Serial.printf("✗ esp_ota_begin failed: %s\n", esp_err_to_name(err));
+            return false;
+        }
+        Serial.printf("✓ Writing to OTA partition %s @ 0x%x\n", sink.partition->label, sink.partition->address);
+        return true;
+    }
+
+    if (kind == SINK_RAW) {
+        sink.partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, RAW_PARTITION_LABEL);
+        if (sink.partition == NULL || !bufferPoolInit()) {
+            Serial.println("✗ No \"" RAW_PARTITION_LABEL "\" data partition for the raw sink");
+            return false;
+        }
+        if (size > 0 && (size_t)size > sink.partition->size) {
+            Serial.printf("✗ Image too large for %s (%ld > %u bytes)\n", sink.partition->label, size, sink.partition->size);
+            return false;
+        }
+        sink.written = 0;
+        sink.erasedTo = 0;
+        sink.blockLen = 0;
+        if (STAGING_FS.exists(RAW_INFO_PATH)) STAGING_FS.remove(RAW_INFO_PATH);  // About to be overwritten
+        // Known size: erase it all before the first byte arrives
+        if (size > 0 && !rawEraseTo(sink, size)) return false;
+        Serial.printf("✓ Writing to raw partition %s @ 0x%x\n", sink.partition->label, sink.partition->address);
+        return true;
+    }
+
+    if (resumeOffset > 0) {
+        sink.file = STAGING_FS.open(path, FILE_APPEND);
+        if (!sink.file || (long)sink.file.size() != resumeOffset) {
+            Serial.println("✗ Partial file does not match resume state");
+            if (sink.file) sink.file.close();
+            return false;
+        }
+        return true;
+    }
+
+    // Clean SPIFFS before writing
+    if (STAGING_FS.exists(path)) STAGING_FS.remove(path);
+
+    // NOTE: STAGING_FS.begin() must have been called in system_init() for this to work
+    sink.file = STAGING_FS.open(path, FILE_WRITE);
+    if (!sink.file) {
+        Serial.println("✗ " STAGING_FS_NAME " Write Error - Did you call system_init()?");
+        return false;
+    }
+    return true;
+}
+
+bool sinkWrite(StorageSink& sink, const uint8_t* data, size_t len) {
+    if (sink.kind == SINK_OTA) return esp_ota_write(sink.ota, data, len) == ESP_OK;
+    if (sink.kind == SINK_RAW) {
+        while (len > 0) {
+            size_t n = min(len, (size_t)CHUNK_SIZE - sink.blockLen);
+            memcpy(bufferPool.sector + sink.blockLen, data, n);
+            sink.blockLen += n;
+            data += n;
+            len -= n;
+            if (sink.blockLen == CHUNK_SIZE && !rawFlushBlock(sink)) return false;
+        }
+        return true;
+    }
+    return sink.file.write(data, len) == len;
+}
+
+// Random-access write into an OTA slot opened with its full size (already
+// erased). SPIFFS cannot write holes, so segments stage in separate files.
+bool sinkWriteAt(StorageSink& sink, long offset, const uint8_t* data, size_t len) {
+    if (sink.kind == SINK_OTA) return esp_ota_write_with_offset(sink.ota, data, len, offset) == ESP_OK;
+    return false;
+}
+
+// Commits the image on success, otherwise throws away whatever was written.
+bool sinkEnd(StorageSink& sink, bool success) {
+    if (sink.kind == SINK_OTA) {
+        if (!success) {
+            esp_ota_abort(sink.ota);
+            return false;
+        }
+        // esp_ota_end() also validates the app image header and segments
+        esp_err_t err = esp_ota_end(sink.ota);
+        if (err == ESP_OK) err = esp_ota_set_boot_partition(sink.partition);
+        if (err != ESP_OK) {
+            Serial.printf("✗ OTA finalize failed: %s\n", esp_err_to_name(err));
+            return false;
+        }
+        Serial.printf("✓ Boot partition set to %s (reboot to apply)\n", sink.partition->label);
+        return true;
+    }
+
+    if (sink.kind == SINK_RAW) {
+        if (!success) return false;
+        // Pad the tail block with the erased value so the write stays whole
+        if (sink.blockLen > 0) {
+            long end = sink.written + sink.blockLen;
+            memset(bufferPool.sector + sink.blockLen, 0xFF, CHUNK_SIZE - sink.blockLen);
+            if (!rawFlushBlock(sink)) return false;
+            sink.written = end;
+        }
+        return true;
+    }
+
+    sink.file.close();
+    if (!success) STAGING_FS.remove(sink.path);
+    return success;
+}
+
+// Erases whole sectors from erasedTo until at least offset end is clean.
+bool rawEraseTo(StorageSink& sink, long end) {
+    end = min((long)sink.partition->size, (end + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE);
+    if (sink.erasedTo >= end) return true;
+    if (esp_partition_erase_range(sink.partition, sink.erasedTo, end - sink.erasedTo) != ESP_OK) {
+        Serial.println("✗ Raw partition erase failed");
+        return false;
+    }
+    sink.erasedTo = end;
+    return true;
+}
+
+// Called by the writer while it waits for data: erases one more sector of
+// the RAW_ERASE_AHEAD window. Returns false once the window is clean (or on
+// any sink but SINK_RAW).
+bool rawEraseAhead(StorageSink& sink) {
+    if (sink.kind != SINK_RAW || sink.erasedTo >= sink.written + CHUNK_SIZE + RAW_ERASE_AHEAD) return false;
+    if (sink.erasedTo >= (long)sink.partition->size) return false;
+    return rawEraseTo(sink, sink.erasedTo + CHUNK_SIZE);
+}
+
+// Writes the gathered sector. Its erase normally happened in an idle gap
+// (rawEraseAhead()); when the writer never idles, only this one sector is
+// erased here, so a write waits on a 4 KB erase at most, never a 64 KB one.
+bool rawFlushBlock(StorageSink& sink) {
+    if (sink.written + CHUNK_SIZE > (long)sink.partition->size) {
+        Serial.println("✗ Raw partition full");
+        return false;
+    }
+    if (!rawEraseTo(sink, sink.written + CHUNK_SIZE)) return false;
+    if (esp_partition_write(sink.partition, sink.written, bufferPool.sector, CHUNK_SIZE) != ESP_OK) return false;
+    sink.written += CHUNK_SIZE;
+    sink.blockLen = 0;
+    return true;
+}
+
+// Records what SINK_RAW left in RAW_PARTITION_LABEL for whoever consumes it.
+void saveRawInfo(long size, const uint8_t* digest) {
+    File f = STAGING_FS.open(RAW_INFO_PATH, FILE_WRITE);
+    if (!f) return;
+    f.write((const uint8_t*)&size, sizeof(size));
+    f.write(digest, 32);
+    f.close();
+}
+
+// Closes a partial SPIFFS download without deleting it, for a later resume.
+void sinkSuspend(StorageSink& sink) {
+    if (sink.kind == SINK_OTA) esp_ota_abort(sink.ota);
+    else if (sink.kind == SINK_FILE) sink.file.close();
+}
+
+// ============================================================================
+// DIGESTS
+// ============================================================================
+
+void hashBegin(StreamHash& h, HashAlgo algo) {
+    h.algo = algo;
+    if (algo == HASH_SHA256) {
+        mbedtls_sha256_init(&h.sha256);
+        mbedtls_sha256_starts_ret(&h.sha256, 0);
+    } else {
+        mbedtls_md5_init(&h.md5);
+        mbedtls_md5_starts_ret(&h.md5);
+    }
+}
+
+void hashUpdate(StreamHash& h, const uint8_t* data, size_t len) {
+    if (h.algo == HASH_SHA256) mbedtls_sha256_update_ret(&h.sha256, data, len);
+    else mbedtls_md5_update_ret(&h.md5, data, len);
+}
+
+// Writes the digest to out (HASH_MAX_LEN bytes) and returns its length.
+size_t hashFinish(StreamHash& h, uint8_t* out) {
+    if (h.algo == HASH_SHA256) {
+        mbedtls_sha256_finish_ret(&h.sha256, out);
+        mbedtls_sha256_free(&h.sha256);
+        return 32;
+    }
+    mbedtls_md5_finish_ret(&h.md5, out);
+    mbedtls_md5_free(&h.md5);
+    return 16;
+}
+
+// Times HASH_BENCH_BYTES of SHA-256 through the SHA engine (hashUpdate(),
+// mbedtls' hardware port) and through Sha256Soft on the CPU, from internal
+// RAM and from a pool chunk (PSRAM when fitted). The two digests must agree.
+void hashBenchmark() {
+    if (!bufferPoolInit()) return;
+    struct BenchBuffer {
+        uint8_t* data;
+        size_t len;
+        const char* where;
+    };
+    BenchBuffer buffers[] = {
+        { bufferPool.bounce, CHUNK_SIZE, "internal" },
+        { bufferPool.chunks[0], bufferPool.chunkSize, bufferPool.psram ? "PSRAM" : "internal" }
+    };
+
+    Serial.println("\n--- HASH BENCHMARK (SHA-256) ---");
+    for (size_t b = 0; b < 2; b++) {
+        BenchBuffer& buf = buffers[b];
+        for (size_t i = 0; i < buf.len; i++) buf.data[i] = (uint8_t)(i * 31);
+
+        uint8_t hw[32], sw[32];
+        uint32_t t0 = micros();
+        StreamHash h;
+        hashBegin(h, HASH_SHA256);
+        for (size_t done = 0; done < HASH_BENCH_BYTES; done += buf.len) hashUpdate(h, buf.data, buf.len);
+        hashFinish(h, hw);
+        uint32_t hwUs = micros() - t0;
+
+        t0 = micros();
+        Sha256Soft s;
+        sha256SoftInit(s);
+        for (size_t done = 0; done < HASH_BENCH_BYTES; done += buf.len) sha256SoftUpdate(s, buf.data, buf.len);
+        sha256SoftFinish(s, sw);
+        uint32_t swUs = micros() - t0;
+
+        Serial.printf("%-8s x %5u B: engine %6.2f MB/s, software %6.2f MB/s (x%.1f)%s\n", buf.where, (unsigned)buf.len,
+                      hwUs ? HASH_BENCH_BYTES / (double)hwUs : 0.0, swUs ? HASH_BENCH_BYTES / (double)swUs : 0.0,
+                      hwUs ? swUs / (double)hwUs : 0.0, memcmp(hw, sw, 32) ? "  ✗ DIGESTS DIFFER" : "");
+    }
+    // hashUpdate() returns only once the engine is done, so the writer task
+    // waits it out; the only overlap is the reader task on the other core
+    Serial.println("Engine calls block the writer task; only the UART reader runs alongside them");
+    Serial.println("----------------------------------------------");
+}
+
+void printDigest(HashAlgo algo, const uint8_t* digest, size_t len) {
+    Serial.print(algo == HASH_SHA256 ? "SHA-256: " : "MD5: ");
+    for (size_t i = 0; i < len; i++) Serial.printf("%02x", digest[i]);
+    Serial.println();
+}
+
+bool digestMatchesHex(const uint8_t* digest, size_t len, const char* hex) {
+    if (strlen(hex) != len * 2) return false;
+    for (size_t i = 0; i < len; i++) {
+        char byteHex[3] = { hex[i * 2], hex[i * 2 + 1], 0 };
+        char* end;
+        if (strtoul(byteHex, &end, 16) != digest[i] || *end) return false;
+    }
+    return true;
+}
+
+// Checks opts.signature (or the one at opts.signedUrl) against the finished
+// SHA-256 before the sink commits. Call with the transport closed: it may
+// issue a GET. Everything passes while SIGNING_PUBLIC_KEY is empty; once it
+// is set, a missing signature, a key that does not parse or a bad signature
+// all reject.
+bool signatureAccepted(const DownloadOptions& opts, HashAlgo algo, const uint8_t* digest) {
+    if (!*SIGNING_PUBLIC_KEY) return true;
+    static uint8_t fetched[SIG_MAX_LEN];
+    const uint8_t* signature = opts.signature;
+    size_t signatureLen = opts.signatureLen;
+    if ((signature == NULL || signatureLen == 0) && opts.signedUrl) {
+        signatureLen = fetchSignature(String(opts.signedUrl), fetched, sizeof(fetched));
+        signature = fetched;
+    }
+    if (signature == NULL || signatureLen == 0) {
+        Serial.println("✗ Image is not signed - rejecting");
+        return false;
+    }
+    if (algo != HASH_SHA256) {
+        Serial.println("✗ Signatures cover SHA-256 only - rejecting");
+        return false;
+    }
+
+    uint32_t t0 = millis();
+    mbedtls_pk_context pk;
+    mbedtls_pk_init(&pk);
+    int ret = mbedtls_pk_parse_public_key(&pk, (const unsigned char*)SIGNING_PUBLIC_KEY, strlen(SIGNING_PUBLIC_KEY) + 1);
+    if (ret == 0) ret = mbedtls_pk_verify(&pk, MBEDTLS_MD_SHA256, digest, 32, signature, signatureLen);
+    mbedtls_pk_free(&pk);
+    telemetryAdd(TM_VERIFY, millis() - t0);
+
+    if (ret != 0) {
+        Serial.printf("✗ Signature INVALID (-0x%04x) - rejecting image\n", -ret);
+        return false;
+    }
+    Serial.println("✓ Signature valid");
+    return true;
+}
+
+// GETs imageUrl + SIG_SUFFIX. Returns the signature length, 0 if there is none.
+size_t fetchSignature(const String& imageUrl, uint8_t* out, size_t cap) {
+    long len = httpFetchToBuffer(imageUrl + SIG_SUFFIX, (char*)out, cap);
+    return len > 0 ? (size_t)len : 0;
+}
+
+// Decodes a hex string into out. Returns the byte count, 0 if malformed.
+size_t hexToBytes(const char* hex, uint8_t* out, size_t cap) {
+    size_t len = strlen(hex);
+    if (len % 2 || len / 2 > cap) return 0;
+    for (size_t i = 0; i < len / 2; i++) {
+        char byteHex[3] = { hex[i * 2], hex[i * 2 + 1], 0 };
+        char* end;
+        out[i] = (uint8_t)strtoul(byteHex, &end, 16);
+        if (*end) return 0;
+    }
+    return len / 2;
+}
+
+// Hashes a stored SPIFFS file. False if it cannot be read.
+bool storedFileDigest(const char* path, HashAlgo algo, uint8_t* out) {
+    File file = STAGING_FS.open(path, FILE_READ);
+    if (!file) {
+        Serial.println("Failed to open file for verification");
+        return false;
+    }
+
+    if (!bufferPoolInit()) {
+        file.close();
+        Serial.println("Memory error in verification");
+        return false;
+    }
+    // Big reads into a pool chunk mean fewer SPIFFS calls
+    uint8_t* vBuf = bufferPool.chunks[0];
+    size_t vLen = bufferPool.chunkSize;
+
+    StreamHash h;
+    hashBegin(h, algo);
+    while (file.available()) {
+        int len = file.read(vBuf, vLen);
+        if (len <= 0) break;
+        hashUpdate(h, vBuf, len);
+    }
+    hashFinish(h, out);
+    file.close();
+    return true;
+}
+
+// Paranoid verify: re-reads path and compares against the inline digest.
+bool calculateStorageChecksum(const char* path, HashAlgo algo, const uint8_t* expected) {
+    Serial.println("\n--- VERIFYING " STAGING_FS_NAME " FILE ---");
+    uint8_t res[HASH_MAX_LEN];
+    uint32_t t0 = millis();
+    if (!storedFileDigest(path, algo, res)) return false;
+    size_t resLen = algo == HASH_SHA256 ? 32 : 16;
+    Serial.printf("Read-back + hash took %lu ms\n", (unsigned long)(millis() - t0));
+    telemetryAdd(TM_VERIFY, millis() - t0);
+
+    printDigest(algo, res, resLen);
+    bool ok = memcmp(res, expected, resLen) == 0;
+    Serial.println(ok ? "✓ Read-back matches streamed digest" : "✗ Read-back digest MISMATCH");
+    Serial.println("----------------------------------------------");
+    return ok;
+}
+
+// Hashes the first size bytes of a raw partition. False on a read error.
+bool partitionDigest(const esp_partition_t* part, size_t size, HashAlgo algo, uint8_t* out) {
+    if (!bufferPoolInit()) {
+        Serial.println("Memory error in verification");
+        return false;
+    }
+    // Raw flash reads go straight into internal DMA memory
+    uint8_t* vBuf = bufferPool.bounce;
+
+    StreamHash h;
+    hashBegin(h, algo);
+    bool readOk = true;
+    for (size_t off = 0; off < size; off += CHUNK_SIZE) {
+        size_t len = min((size_t)CHUNK_SIZE, size - off);
+        if (esp_partition_read(part, off, vBuf, len) != ESP_OK) {
+            Serial.println("Partition read failed during verification");
+            readOk = false;
+            break;
+        }
+        hashUpdate(h, vBuf, len);
+    }
+    hashFinish(h, out);
+    return readOk;
+}
+
+// Paranoid verify for the OTA sink, reading the raw partition back.
+bool calculatePartitionChecksum(const esp_partition_t* part, size_t size, HashAlgo algo, const uint8_t* expected) {
+    Serial.printf("\n--- VERIFYING OTA PARTITION %s ---\n", part->label);
+
+    uint8_t res[HASH_MAX_LEN];
+    size_t resLen = algo == HASH_SHA256 ? 32 : 16;
+    uint32_t t0 = millis();
+    bool readOk = partitionDigest(part, size, algo, res);
+    Serial.printf("Read-back + hash took %lu ms\n", (unsigned long)(millis() - t0));
+    telemetryAdd(TM_VERIFY, millis() - t0);
+
+    printDigest(algo, res, resLen);
+    bool ok = readOk && memcmp(res, expected, resLen) == 0;
+    Serial.println(ok ? "✓ Read-back matches streamed digest" : "✗ Read-back digest MISMATCH");
+    Serial.println("----------------------------------------------");
+    return ok;
+}
+
+// True if the modem answers AT at the default rate or at any rate we may have
+// left it on before an ESP32-only reset. Leaves CellUART at that rate.
+bool modemAlive() {
+    if (probeLink(1) || probeLink(1)) return true;
+    for (size_t i = 0; i < sizeof(CELL_BAUD_RATES) / sizeof(CELL_BAUD_RATES[0]); i++) {
+        CellUART.updateBaudRate(CELL_BAUD_RATES[i]);
+        cellBaud = CELL_BAUD_RATES[i];
+        drainModem(20, 100);
+        if (probeLink(1)) {
+            Serial.printf("✓ Modem found at %lu baud\n", (unsigned long)cellBaud);
+            return true;
+        }
+    }
+    cellBaud = BAUD_CELLULAR;
+    CellUART.updateBaudRate(cellBaud);
+    return false;
+}
+
+// SIM ready, registered (home or roaming, LTE or 2G) and PDP context 1 up.
+bool networkReady() {
+    char line[AT_LINE_MAX];
+    int n, stat;
+    sendAT("ATE0", "OK", 1000);
+    if (!sendAT("AT+CPIN?", "READY", 1000)) return false;
+    selectProfile();  // Download URLs may depend on it even when no attach is needed
+
+    bool registered = false;
+    if (atQuery("AT+CEREG?", "+CEREG:", line, sizeof(line), 1000) &&
+        sscanf(line, "+CEREG: %d,%d", &n, &stat) == 2) registered = stat == 1 || stat == 5;
+    if (!registered && atQuery("AT+CGREG?", "+CGREG:", line, sizeof(line), 1000) &&
+        sscanf(line, "+CGREG: %d,%d", &n, &stat) == 2) registered = stat == 1 || stat == 5;
+    if (!registered) return false;
+
+    return pdpContextActive();
+}
+
+// Queries PDP context 1 and caches its address in pdpAddress when it is up.
+bool pdpContextActive() {
+    char line[AT_LINE_MAX];
+    // "+QIACT: <id>,<state>,<type>,"<ip>"" is only listed for contexts that are up
+    if (!atQuery("AT+QIACT?", "+QIACT: 1,1", line, sizeof(line), 2000)) {
+        pdpAddress[0] = 0;
+        return false;
+    }
+    const char* ip = strchr(line, '"');
+    if (ip) {
+        size_t n = strcspn(ip + 1, "\"");
+        if (n >= sizeof(pdpAddress)) n = sizeof(pdpAddress) - 1;
+        memcpy(pdpAddress, ip + 1, n);
+        pdpAddress[n] = 0;
+    }
+    return true;
+}
+
+// Brings up the data bearer, reusing an active context instead of tearing it
+// down. Cheap enough to call before every download.
+bool connectNetwork() {
+    sendAT("ATE0", "OK", 1000);
+    uint32_t t0 = millis();
+    bool simReady = sendAT("AT+CPIN?", "READY", 2000);
+    telemetryAdd(TM_SIM, millis() - t0);
+    if (!simReady) return false;
+
+    t0 = millis();
+    if (pdpContextActive()) {
+        telemetryAdd(TM_PDP, millis() - t0);
+        Serial.printf("✓ Reusing PDP context (IP %s)\n", pdpAddress);
+        return true;
+    }
+
+    // Be sure APN is correct. A SIM no profile claims walks the list once
+    // here instead of burning power cycles on the wrong APN.
+    if (selectProfile() < 0) {
+        Serial.println("✗ No carrier profile");
+        return false;
+    }
+    int candidates = profileMatched ? 1 : profileCount;
+    bool active = false;
+    for (int i = 0; i < candidates && !active; i++) {
+        if (i > 0) activeProfile = (activeProfile + 1) % profileCount;
+        const CarrierProfile& prof = profiles[activeProfile];
+        char cmd[192];
+        snprintf(cmd, sizeof(cmd), "AT+QICSGP=1,1,\"%s\",\"%s\",\"%s\",%d", prof.apn, prof.user, prof.pass, prof.auth);
+        if (i > 0) Serial.printf("Trying carrier profile '%s'\n", prof.name);
+        if (!sendAT(cmd, "OK", 2000)) continue;
+        if (!sendAT("AT+QIACT=1", "OK", 10000)) {
+            // A half-open context can block activation; clear it and try once more
+            sendAT("AT+QIDEACT=1", "OK", 5000);
+            if (!sendAT("AT+QIACT=1", "OK", 10000)) continue;
+        }
+        active = pdpContextActive();
+    }
+
+    telemetryAdd(TM_PDP, millis() - t0);
+    if (!active) return false;
+    Serial.printf("✓ PDP context active (IP %s, profile '%s')\n", pdpAddress, profiles[activeProfile].name);
+    profileMatched = true;  // This one works; stop rotating on later drops
+    saveLastProfile();
+    return true;
+}
+
+void powerCycleModem() {
+    Serial.println("Power cycling modem...");
+    uint32_t t0 = millis();
+    // The modem comes back at its default rate with flow control off
+    if (cellBaud != BAUD_CELLULAR) {
+        cellBaud = BAUD_CELLULAR;
+        CellUART.updateBaudRate(cellBaud);
+    }
+    if (cellFlowControl) {
+        CellUART.setHwFlowCtrlMode(UART_HW_FLOWCTRL_DISABLE);
+        cellFlowControl = false;
+    }
+    pdpAddress[0] = 0;
+    httpSessionReady = false;
+    tlsReady = false;
+    pinMode(PIN_CELL_RST, OUTPUT);
+    pinMode(PIN_CELL_PWRKEY, OUTPUT);
+
+    // Reset Sequence
+    digitalWrite(PIN_CELL_RST, HIGH);
+    delay(200);
+    digitalWrite(PIN_CELL_RST, LOW);
+
+    // If reset alone brought it back, skip PWRKEY (a pulse would switch it off)
+    if (atWaitFor("RDY", 3000, false) == AT_MATCH) {
+        Serial.println("✓ Modem ready after reset");
+        telemetryAdd(TM_POWER_CYCLE, millis() - t0);
+        return;
+    }
+
+    // Power Key Sequence
+    digitalWrite(PIN_CELL_PWRKEY, HIGH);
+    delay(1000);
+    digitalWrite(PIN_CELL_PWRKEY, LOW);
+
+    // Boot normally takes a few seconds; RDY marks the end of it
+    if (atWaitFor("RDY", 10000, false) == AT_MATCH) Serial.println("✓ Modem ready");
+    else Serial.println("✗ No RDY from modem, continuing anyway");
+    telemetryAdd(TM_POWER_CYCLE, millis() - t0);
+}
+
+// ============================================================================
+// FLOW CONTROL / BAUD RATE NEGOTIATION
+// ============================================================================
+
+// Turns on RTS/CTS when the pins are wired: modem first (AT+IFC=2,2), then our
+// side, so the modem holds off instead of overrunning us during flash stalls.
+bool enableFlowControl() {
+    if (PIN_CELL_RTS < 0 || PIN_CELL_CTS < 0) return false;
+    if (cellFlowControl) return true;
+
+    if (!sendAT("AT+IFC=2,2", "OK", 1000)) {
+        Serial.println("✗ Modem refused hardware flow control");
+        return false;
+    }
+    CellUART.setPins(PIN_CELL_RX, PIN_CELL_TX, PIN_CELL_CTS, PIN_CELL_RTS);
+    CellUART.setHwFlowCtrlMode(UART_HW_FLOWCTRL_CTS_RTS, CELL_RTS_THRESHOLD);
+
+    cellFlowControl = probeLink(2);
+    if (!cellFlowControl) {
+        // Most likely a wiring problem; go back to a plain 3-wire link
+        CellUART.setHwFlowCtrlMode(UART_HW_FLOWCTRL_DISABLE);
+        sendAT("AT+IFC=0,0", "OK", 1000);
+        Serial.println("✗ No response with RTS/CTS, flow control disabled");
+        return false;
+    }
+    Serial.println("✓ Hardware flow control enabled (RTS/CTS)");
+    return true;
+}
+
+// Steps down CELL_BAUD_RATES (from maxBaud) until the link survives a burst of
+// ATs. Stays at the current rate if nothing faster is stable.
+bool negotiateBaudRate(uint32_t maxBaud) {
+    for (size_t i = 0; i < sizeof(CELL_BAUD_RATES) / sizeof(CELL_BAUD_RATES[0]); i++) {
+        uint32_t baud = CELL_BAUD_RATES[i];
+        if (baud > maxBaud || baud <= cellBaud) continue;
+        if (switchBaudRate(baud)) {
+            Serial.printf("✓ Cellular UART running at %lu baud\n", (unsigned long)baud);
+            return true;
+        }
+        Serial.printf("✗ %lu baud unstable, falling back\n", (unsigned long)baud);
+    }
+    return false;
+}
+
+// Moves both ends to baud and checks the link. On failure restores the
+// previous rate; if even that does not answer, the next power cycle will.
+bool switchBaudRate(uint32_t baud) {
+    uint32_t prev = cellBaud;
+    char cmd[24];
+    snprintf(cmd, sizeof(cmd), "AT+IPR=%lu", (unsigned long)baud);
+    // The modem answers OK at the old rate, then switches
+    if (!sendAT(cmd, "OK", 1000)) return false;
+
+    cellLink.flush();
+    CellUART.updateBaudRate(baud);
+    cellBaud = baud;
+    delay(50);
+    drainModem(20, 200);
+
+    if (probeLink(BAUD_PROBE_COUNT)) return true;
+
+    // Ask the modem to go back (may arrive garbled), then follow it
+    snprintf(cmd, sizeof(cmd), "AT+IPR=%lu", (unsigned long)prev);
+    sendAT(cmd, "OK", 500);
+    cellLink.flush();
+    CellUART.updateBaudRate(prev);
+    cellBaud = prev;
+    delay(50);
+    drainModem(20, 200);
+    if (!probeLink(2)) Serial.println("✗ Modem lost after baud fallback");
+    return false;
+}
+
+// True if count back-to-back ATs all get an OK.
+bool probeLink(int count) {
+    for (int i = 0; i < count; i++) {
+        if (!sendAT("AT", "OK", 300)) return false;
+    }
+    return true;
+}
+
+// Drops one step in CELL_BAUD_RATES (or to the default) after a failed transfer.
+void lowerBaudRate() {
+    if (cellBaud == BAUD_CELLULAR) return;
+    uint32_t next = BAUD_CELLULAR;
+    for (size_t i = 0; i < sizeof(CELL_BAUD_RATES) / sizeof(CELL_BAUD_RATES[0]); i++) {
+        if (CELL_BAUD_RATES[i] < cellBaud) {
+            next = CELL_BAUD_RATES[i];
+            break;
+        }
+    }
+    Serial.printf("Lowering cellular UART to %lu baud\n", (unsigned long)next);
+    telemetry.baudDowngrades++;
+    if (!switchBaudRate(next)) Serial.println("✗ Baud step-down failed");
+}
+
+// Sends cmd (if any) and waits for a line containing expected. Gives up early
+// on a final result code that arrives first.
+bool sendAT(const char* cmd, const char* expected, uint32_t timeout) {
+    return atSend(atChannel, cmd, expected, timeout);
+}
+
+// Sends cmd and copies the first response line starting with prefix into out,
+// then consumes the final result. False if the modem answered without it.
+bool atQuery(const char* cmd, const char* prefix, char* out, size_t outLen, uint32_t timeout) {
+    return atQuery(atChannel, cmd, prefix, out, outLen, timeout);
+}
+
+// Waits for a line containing token. Returns as soon as it arrives or a final
+// result code (OK/ERROR) comes first; timeout is only an upper bound.
+bool waitForResponse(const char* token, uint32_t timeout) {
+    return atWaitFor(token, timeout, true) == AT_MATCH;
+}
+
+// ============================================================================
+// AT PARSER
+// ============================================================================
+
+// The parser itself lives in lib/ModemCore (AtChannel); these run it on the
+// cellular link.
+
+// Reads modem lines until one contains expected, a final error arrives, or
+// (with stopOnOk) a final OK arrives first. The matching line stays in
+// atChannel.parser.line for the caller to parse. Returns on the CONNECT line
+// itself so the data that follows is left in the UART buffer.
+AtResult atWaitFor(const char* expected, uint32_t timeout, bool stopOnOk) {
+    return atWaitFor(atChannel, expected, timeout, stopOnOk);
+}
+
+// Registers a handler for URCs starting with prefix (string must outlive the
+// registration). Returns false when all slots are taken.
+bool atOnUrc(const char* prefix, AtUrcHandler handler) {
+    return atOnUrc(atChannel, prefix, handler);
+}
+
+void atDispatchUrc(const char* line) {
+    if (!atDispatchUrc(atChannel, line)) log_d("Unhandled URC: %s", line);
+}
+
+// Feeds a canned response mix through the line parser and the HTTP header
+// parser and reports CPU cost per byte. Nothing is sent to the modem.
+void parserBenchmark() {
+    static const char script[] =
+        "\r\nOK\r\n"
+        "\r\n+CSQ: 21,99\r\n\r\nOK\r\n"
+        "\r\n+QIACT: 1,1,1,\"10.64.0.2\"\r\n\r\nOK\r\n"
+        "\r\n+QIND: \"csq\",21,99\r\n"
+        "\r\n+QHTTPGET: 0,200,1048576\r\n"
+        "\r\n+CME ERROR: 703\r\n"
+        "\r\nCONNECT\r\n";
+    static const char headers[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/octet-stream\r\n"
+        "Content-Length: 1048576\r\n"
+        "ETag: \"6805f2cfc46c0f04559748bb039d69ae\"\r\n"
+        "Last-Modified: Tue, 01 Oct 2024 10:00:00 GMT\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "Server: AmazonS3\r\n\r\n";
+    const int rounds = 2000;
+
+    Serial.println("\n--- PARSER BENCHMARK ---");
+    AtParser p = {};
+    int lines = 0;
+    volatile int kinds = 0;
+    uint32_t t0 = micros();
+    for (int r = 0; r < rounds; r++) {
+        for (const char* c = script; *c; c++) {
+            if (!atFeed(p, *c)) continue;
+            kinds += atClassify(p.line);
+            lines++;
+        }
+    }
+    uint32_t us = micros() - t0;
+    double bytes = (double)rounds * (sizeof(script) - 1);
+    Serial.printf("AT lines:     %d lines, %.1f ns/byte, %.2f us/line\n", lines, us * 1000.0 / bytes, us / (double)lines);
+
+    HttpHeaderParser h;
+    t0 = micros();
+    for (int r = 0; r < rounds; r++) {
+        httpHeaderBegin(h);
+        httpHeaderFeed(h, (const uint8_t*)headers, sizeof(headers) - 1);
+    }
+    us = micros() - t0;
+    bytes = (double)rounds * (sizeof(headers) - 1);
+    Serial.printf("HTTP headers: %.1f ns/byte, %.2f us/response\n", us * 1000.0 / bytes, us / (double)rounds);
+    Serial.println("----------------------------------------------");
+}
+
+// Runs on the UART driver's event task.
+void onCellReceive() {
+    xSemaphoreGive(cellRxSignal);
+}
+
+// Blocks until CellUART has data or timeout ms have passed since start.
+// Returns true if data is available.
+bool cellWaitForData(uint32_t start, uint32_t timeout) {
+    while (cellLink.available() <= 0) {
+        uint32_t elapsed = millis() - start;
+        if (elapsed >= timeout) return false;
+        if (cellRxSignal == NULL) {
+            vTaskDelay(1);
+            continue;
+        }
+        xSemaphoreTake(cellRxSignal, pdMS_TO_TICKS(timeout - elapsed));
+    }
+    return true;
+}
+
+// ============================================================================
+// BACKGROUND DOWNLOADER
+// ============================================================================
+
+void downloaderTask(void* arg) {
+    if (gsm_setup()) {
+        Serial.println("\n✓ GSM Setup Successful - Starting Download...\n");
+        startDownload();
+    } else {
+        Serial.println("\n✗ GSM Setup Failed - Cannot download\n");
+        downloaderEnter(DL_FAILED);
+    }
+    vTaskDelete(NULL);
+}
+
+// Copies the counters the web handlers report into downloader. Call with
+// downloaderLock held, from the downloader task (their only writer).
+static void downloaderPublishLocked() {
+    downloader.httpStatus = lastHttpStatus;
+    downloader.retries = telemetry.retries;
+    downloader.bytes = telemetry.bytes;
+    downloader.transferMs = telemetry.phaseMs[TM_TRANSFER];
+    downloader.baud = cellBaud;
+}
+
+void downloaderEnter(DownloaderState state) {
+    portENTER_CRITICAL(&downloaderLock);
+    downloader.state = state;
+    downloaderPublishLocked();
+    if (state == DL_DOWNLOADING) {
+        downloader.received = 0;
+        downloader.total = 0;
+    }
+    if (state == DL_DONE || state == DL_FAILED) downloader.finishedMs = millis();
+    portEXIT_CRITICAL(&downloaderLock);
+}
+
+void downloaderProgress(long received, long total) {
+    portENTER_CRITICAL(&downloaderLock);
+    downloader.received = received;
+    downloader.total = total;
+    downloaderPublishLocked();
+    portEXIT_CRITICAL(&downloaderLock);
+}
+
+// ============================================================================
+// LOCAL IMAGE SHARING
+// ============================================================================
+
+// Adds GET/HEAD FILE_PATH (the staged image, with single-range support) and
+// GET /progress (downloader status as JSON) to server. Handlers run on the
+// loop() task, so a slow Wi-Fi client never holds up the downloader task.
+void gsm_register_web(WebServer& server) {
+    static const char* headerKeys[] = { "Range", "If-None-Match" };
+    server.collectHeaders(headerKeys, sizeof(headerKeys) / sizeof(headerKeys[0]));
+    server.on(FILE_PATH, HTTP_ANY, [&server]() { handleImageRequest(server); });
+    server.on("/progress", HTTP_GET, [&server]() { handleProgressRequest(server); });
+}
+
+void handleImageRequest(WebServer& server) {
+    // Only a finished, verified file is handed out; mid-download it is partial
+    // (or about to be discarded), and a deferred retry is cheaper than bad data.
+    DownloaderStatus st = gsm_status();
+    if (st.state != DL_IDLE && st.state != DL_DONE && st.state != DL_FAILED) {
+        server.sendHeader("Retry-After", String(SHARE_RETRY_AFTER));
+        server.send(503, "text/plain", "Download in progress");
+        return;
+    }
+    if (DOWNLOAD_SINK != SINK_FILE || STAGING_FS.exists(RESUME_PATH)) {
+        server.send(404, "text/plain", "No staged image");
+        return;
+    }
+    File f = STAGING_FS.open(FILE_PATH, FILE_READ);
+    if (!f) {
+        server.send(404, "text/plain", "No staged image");
+        return;
+    }
+    long size = (long)f.size();
+
+    // The validators we got from the CDN identify the file for peers too
+    HttpValidators v;
+    if (loadValidators(FILE_PATH, v) && v.etag[0]) {
+        server.sendHeader("ETag", v.etag);
+        if (server.header("If-None-Match") == v.etag) {
+            f.close();
+            server.send(304);
+            return;
+        }
+    }
+
+    long from = 0;
+    long to = size - 1;
+    int code = 200;
+    if (server.hasHeader("Range")) {
+        if (!parseByteRange(server.header("Range"), size, from, to)) {
+            f.close();
+            server.sendHeader("Content-Range", "bytes */" + String(size));
+            server.send(416);
+            return;
+        }
+        code = 206;
+        server.sendHeader("Content-Range", "bytes " + String(from) + "-" + String(to) + "/" + String(size));
+    }
+    server.sendHeader("Accept-Ranges", "bytes");
+    server.setContentLength(to - from + 1);
+    server.send(code, "application/octet-stream", "");
+    if (server.method() == HTTP_HEAD) {
+        f.close();
+        return;
+    }
+
+    // One static bounce buffer straight from the file into the socket: no
+    // String or heap copy per request (handlers never run concurrently)
+    static uint8_t buf[CHUNK_SIZE];
+    WiFiClient client = server.client();
+    f.seek(from);
+    long left = to - from + 1;
+    while (left > 0 && client.connected()) {
+        size_t n = f.read(buf, min((long)sizeof(buf), left));
+        if (n == 0 || client.write(buf, n) != n) break;
+        left -= n;
+    }
+    f.close();
+}
+
+void handleProgressRequest(WebServer& server) {
+    DownloaderStatus st = gsm_status();
+    uint32_t elapsed = (st.finishedMs ? st.finishedMs : millis()) - st.startedMs;
+    JsonDocument doc;
+    doc["state"] = DL_STATE_NAMES[st.state];
+    doc["received"] = st.received;
+    doc["total"] = st.total;
+    doc["percent"] = st.total > 0 ? (int)(st.received * 100 / st.total) : 0;
+    doc["elapsed_ms"] = st.startedMs ? elapsed : 0;
+    doc["http_status"] = st.httpStatus;
+    doc["retries"] = st.retries;
+    doc["baud"] = st.baud;
+    doc["transfer_ms"] = st.transferMs;
+    doc["bytes"] = st.bytes;
+    String body;
+    serializeJson(doc, body);
+    server.sendHeader("Cache-Control", "no-store");
+    server.send(200, "application/json", body);
+}
+
+// "bytes=a-b", "bytes=a-" or "bytes=-n" against a file of size bytes.
+bool parseByteRange(const String& header, long size, long& from, long& to) {
+    if (!header.startsWith("bytes=") || header.indexOf(',') >= 0 || size <= 0) return false;
+    int dash = header.indexOf('-');
+    if (dash < 0) return false;
+    String first = header.substring(6, dash);
+    String last = header.substring(dash + 1);
+    if (first.length() == 0) {
+        long n = last.toInt();
+        if (n <= 0) return false;
+        from = max(0L, size - n);
+        to = size - 1;
+        return true;
+    }
+    from = first.toInt();
+    to = last.length() ? min(last.toInt(), size - 1) : size - 1;
+    return from >= 0 && from < size && from <= to;
+}
+
+// ============================================================================
+// CARRIER PROFILES
+// ============================================================================
+
+// PROFILES_PATH if present and valid, DEFAULT_PROFILES otherwise.
+bool loadProfiles() {
+    File f = STAGING_FS.open(PROFILES_PATH, FILE_READ);
+    if (f) {
+        size_t size = f.size();
+        char* json = (char*)malloc(size + 1);
+        size_t got = json ? f.read((uint8_t*)json, size) : 0;
+        f.close();
+        profileCount = got == size ? parseProfiles(json, size) : 0;
+        free(json);
+        if (profileCount > 0) return true;
+        Serial.printf("✗ %s unusable, using built-in carrier profiles\n", PROFILES_PATH);
+    }
+    profileCount = parseProfiles(DEFAULT_PROFILES, strlen(DEFAULT_PROFILES));
+    return profileCount > 0;
+}
+
+// Fills profiles[] (and the top-level URL overrides). Returns the count.
+int parseProfiles(const char* json, size_t len) {
+    JsonDocument doc;
+    DeserializationError err = deserializeJson(doc, json, len);
+    if (err) {
+        Serial.printf("✗ Carrier profile parse error: %s\n", err.c_str());
+        return 0;
+    }
+    strlcpy(defaultUrl, doc["url"] | "", sizeof(defaultUrl));
+    strlcpy(defaultManifestUrl, doc["manifest_url"] | "", sizeof(defaultManifestUrl));
+
+    int count = 0;
+    for (JsonVariantConst p : doc["profiles"].as<JsonArrayConst>()) {
+        if (count >= PROFILE_MAX) {
+            Serial.printf("✗ More than %d carrier profiles, ignoring the rest\n", PROFILE_MAX);
+            break;
+        }
+        const char* apn = p["apn"] | "";
+        if (!*apn) continue;
+        CarrierProfile& prof = profiles[count++];
+        memset(&prof, 0, sizeof(prof));
+        strlcpy(prof.name, p["name"] | apn, sizeof(prof.name));
+        strlcpy(prof.apn, apn, sizeof(prof.apn));
+        strlcpy(prof.user, p["user"] | "", sizeof(prof.user));
+        strlcpy(prof.pass, p["pass"] | "", sizeof(prof.pass));
+        prof.auth = p["auth"] | 1;
+        strlcpy(prof.url, p["url"] | "", sizeof(prof.url));
+        strlcpy(prof.manifestUrl, p["manifest_url"] | "", sizeof(prof.manifestUrl));
+        for (JsonVariantConst plmn : p["plmn"].as<JsonArrayConst>()) {
+            if (prof.plmnCount >= PROFILE_PLMN_MAX) break;
+            strlcpy(prof.plmn[prof.plmnCount++], plmn | "", sizeof(prof.plmn[0]));
+        }
+    }
+    return count;
+}
+
+// Picks the profile for the inserted SIM once per boot (needs SIM ready):
+// the cached last-working profile if it was this IMSI, else the longest
+// PLMN prefix match, else the fallback. Returns its index, -1 if none.
+int selectProfile() {
+    if (activeProfile >= 0) return activeProfile;
+    if (!loadProfiles()) return -1;
+    if (!readImsi(simImsi, sizeof(simImsi))) simImsi[0] = 0;
+
+    char cached[64] = "";
+    File f = STAGING_FS.open(PROFILE_LAST_PATH, FILE_READ);
+    if (f) {
+        cached[f.read((uint8_t*)cached, sizeof(cached) - 1)] = 0;
+        f.close();
+    }
+    const char* cachedName = strchr(cached, ' ');
+    bool cacheValid = simImsi[0] && cachedName && (size_t)(cachedName - cached) == strlen(simImsi) &&
+                      strncmp(cached, simImsi, strlen(simImsi)) == 0;
+
+    int best = -1;
+    size_t bestLen = 0;
+    int fallback = -1;
+    for (int i = 0; i < profileCount; i++) {
+        const CarrierProfile& prof = profiles[i];
+        if (cacheValid && strcmp(prof.name, cachedName + 1) == 0) {
+            best = i;
+            bestLen = SIZE_MAX;
+            break;
+        }
+        if (prof.plmnCount == 0 && fallback < 0) fallback = i;
+        for (int j = 0; j < prof.plmnCount; j++) {
+            size_t n = strlen(prof.plmn[j]);
+            if (n > bestLen && strncmp(simImsi, prof.plmn[j], n) == 0) {
+                best = i;
+                bestLen = n;
+            }
+        }
+    }
+    profileMatched = best >= 0;
+    activeProfile = best >= 0 ? best : fallback >= 0 ? fallback : 0;
+    Serial.printf("✓ Carrier profile '%s' (IMSI %.6s..., %s)\n", profiles[activeProfile].name, simImsi,
+                  bestLen == SIZE_MAX ? "last working" : profileMatched ? "PLMN match" : "no match");
+    return activeProfile;
+}
+
+// AT+CIMI answers with a bare line of digits.
+bool readImsi(char* out, size_t outLen) {
+    cellLink.println("AT+CIMI");
+    uint32_t start = millis();
+    while (millis() - start < 2000) {
+        if (atWaitFor("", 2000 - (millis() - start), true) != AT_MATCH) return false;
+        const char* line = atChannel.parser.line;
+        size_t n = strlen(line);
+        if (n >= 6 && n < outLen && strspn(line, "0123456789") == n) {
+            strcpy(out, line);
+            atWaitFor(NULL, 300, true);
+            return true;
+        }
+        AtLineKind kind = atClassify(line);
+        if (kind == AT_LINE_OK || kind == AT_LINE_ERROR) return false;
+        if (kind == AT_LINE_URC) atDispatchUrc(line);
+    }
+    return false;
+}
+
+void saveLastProfile() {
+    if (!simImsi[0] || activeProfile < 0) return;
+    char entry[64];
+    snprintf(entry, sizeof(entry), "%s %s", simImsi, profiles[activeProfile].name);
+
+    char stored[64] = "";
+    File f = STAGING_FS.open(PROFILE_LAST_PATH, FILE_READ);
+    if (f) {
+        stored[f.read((uint8_t*)stored, sizeof(stored) - 1)] = 0;
+        f.close();
+    }
+    if (strcmp(stored, entry) == 0) return;  // Spare the flash
+    f = STAGING_FS.open(PROFILE_LAST_PATH, FILE_WRITE);
+    if (!f) return;
+    f.print(entry);
+    f.close();
+}
+
+// Download URLs after profile overrides. Safe before selectProfile().
+const char* imageUrl() {
+    if (activeProfile >= 0 && profiles[activeProfile].url[0]) return profiles[activeProfile].url;
+    return defaultUrl[0] ? defaultUrl : URL_BASE;
+}
+
+const char* manifestUrl() {
+    if (activeProfile >= 0 && profiles[activeProfile].manifestUrl[0]) return profiles[activeProfile].manifestUrl;
+    return defaultManifestUrl[0] ? defaultManifestUrl : MANIFEST_URL;
+}
+
+// ============================================================================
+// SCHEDULED CHECKS / SLEEP
+// ============================================================================
+
+// Call from loop(). Once the downloader has finished and AWAKE_WINDOW_MS has
+// passed, puts the modem and the S3 to sleep until the next check (does not
+// return). No-op with UPDATE_CHECK_INTERVAL 0.
+void gsm_idle_sleep() {
+    if (UPDATE_CHECK_INTERVAL == 0) return;
+    DownloaderStatus st = gsm_status();
+    if (st.state != DL_DONE && st.state != DL_FAILED) return;
+    if (millis() - st.finishedMs < AWAKE_WINDOW_MS) return;
+    sleepUntilNextCheck(st.state == DL_DONE);
+}
+
+void sleepUntilNextCheck(bool lastRunOk) {
+    uint32_t seconds = lastRunOk ? UPDATE_CHECK_INTERVAL : UPDATE_RETRY_INTERVAL;
+    if (MODEM_SLEEP != MODEM_SLEEP_PSM || !modemEnterPsm()) modemPowerDown();
+
+    scheduledChecks++;
+    Serial.printf("Deep sleep for %lu s until the next update check\n", (unsigned long)seconds);
+    Serial.flush();
+
+    // Floating control lines could pulse PWRKEY and switch the modem back on.
+    // On the PSM fast path nothing has driven them since boot.
+    pinMode(PIN_CELL_PWRKEY, OUTPUT);
+    pinMode(PIN_CELL_RST, OUTPUT);
+    digitalWrite(PIN_CELL_PWRKEY, LOW);
+    digitalWrite(PIN_CELL_RST, LOW);
+    gpio_hold_en((gpio_num_t)PIN_CELL_PWRKEY);
+    gpio_hold_en((gpio_num_t)PIN_CELL_RST);
+    gpio_deep_sleep_hold_en();
+
+    esp_sleep_enable_timer_wakeup((uint64_t)seconds * 1000000ULL);
+    esp_deep_sleep_start();
+}
+
+// Orderly detach and power-off, so the next boot is a clean power-on.
+bool modemPowerDown() {
+    bool off = sendAT("AT+QPOWD=1", "OK", 1000) && atWaitFor("POWERED DOWN", 65000, false) == AT_MATCH;
+    if (!off && !modemAlive()) {
+        // PWRKEY toggles, so pulsing a modem that is already off would start it
+        Serial.println("Modem silent at every rate - already off");
+        off = true;
+    } else if (!off) {
+        // modemAlive() may have found it at another rate; QPOWD first, PWRKEY if that fails
+        off = sendAT("AT+QPOWD=1", "OK", 1000) && atWaitFor("POWERED DOWN", 65000, false) == AT_MATCH;
+        for (int pulse = 0; pulse < 2 && !off; pulse++) {
+            // A long pulse turns a running modem off. RDY instead means it had
+            // gone down meanwhile and this pulse started it: go round once more.
+            modemPwrkeyPulse(1000);
+            bool started = false;
+            uint32_t start = millis();
+            while (!off && !started && millis() - start < 30000) {
+                if (atWaitFor("", 30000 - (millis() - start), false) != AT_MATCH) break;
+                off = strstr(atChannel.parser.line, "POWERED DOWN") != NULL;
+                started = strstr(atChannel.parser.line, "RDY") != NULL;
+            }
+            if (!off && !started) break;
+        }
+    }
+    pdpAddress[0] = 0;
+    httpSessionReady = false;
+    tlsReady = false;
+    cellBaud = BAUD_CELLULAR;
+    cellFlowControl = false;
+    Serial.println(off ? "✓ Modem powered down" : "✗ Modem did not confirm power-down");
+    return off;
+}
+
+// Asks the network for PSM. The modem keeps its registration (and usually
+// its PDP context), so the next check skips attach entirely.
+bool modemEnterPsm() {
+    if (!sendAT("AT+CPSMS=1,,,\"" PSM_PERIODIC_TAU "\",\"" PSM_ACTIVE_TIME "\"", "OK", 2000)) {
+        Serial.println("✗ Modem refused PSM, powering it down instead");
+        return false;
+    }
+    modemInPsm = true;
+    Serial.println("✓ Modem entering PSM");
+    return true;
+}
+
+// A short PWRKEY pulse wakes a modem out of PSM (a long one would turn it
+// off). Returns false if we did not leave it in PSM.
+bool modemWakeFromPsm() {
+    if (!modemInPsm) return false;
+    modemInPsm = false;
+    modemPwrkeyPulse(300);
+    atWaitFor("RDY", 2000, false);
+    return true;
+}
+
+// Drives PWRKEY high for ms. The pin may not have been set up since boot.
+void modemPwrkeyPulse(uint32_t ms) {
+    pinMode(PIN_CELL_PWRKEY, OUTPUT);
+    digitalWrite(PIN_CELL_PWRKEY, HIGH);
+    delay(ms);
+    digitalWrite(PIN_CELL_PWRKEY, LOW);
+}
+
+// ============================================================================
+// TELEMETRY
+// ============================================================================
+
+void telemetryReset() {
+    telemetry = Telemetry();
+}
+
+void telemetryAdd(TelemetryPhase phase, uint32_t ms) {
+    telemetry.phaseMs[phase] += ms;
+}
+
+// Prints the run as one JSON line and appends it to TELEMETRY_PATH.
+void telemetryReport(bool success) {
+    char line[64];
+    if (!telemetry.op[0] && atQuery("AT+COPS?", "+COPS:", line, sizeof(line), 2000)) {
+        const char* q = strchr(line, '"');
+        if (q) {
+            size_t n = min(strcspn(q + 1, "\""), sizeof(telemetry.op) - 1);
+            memcpy(telemetry.op, q + 1, n);
+            telemetry.op[n] = 0;
+        }
+    }
+    int rssi = 99;
+    if (atQuery("AT+CSQ", "+CSQ:", line, sizeof(line), 1000)) sscanf(line, "+CSQ: %d", &rssi);
+
+    uint32_t transferMs = telemetry.phaseMs[TM_TRANSFER];
+    JsonDocument doc;
+    doc["fw"] = esp_ota_get_app_description()->version;
+    doc["uptime_ms"] = millis();
+    doc["ok"] = success;
+    doc["http_status"] = lastHttpStatus;
+    doc["operator"] = telemetry.op;
+    doc["profile"] = activeProfile >= 0 ? profiles[activeProfile].name : "";
+    doc["csq"] = rssi;
+    doc["transport"] = DOWNLOAD_TRANSPORT == TRANSPORT_TCP ? "tcp" : DOWNLOAD_TRANSPORT == TRANSPORT_UFS ? "ufs" : "qhttp";
+    doc["baud"] = cellBaud;
+    doc["flow_control"] = cellFlowControl;
+    doc["bytes"] = telemetry.bytes;
+    doc["kbps"] = transferMs ? telemetry.bytes / 1.024 / transferMs : 0.0;
+    doc["max_rx_fill"] = telemetry.maxRxFill;
+    doc["rx_buffer"] = cellRxRing;
+    doc["retries"] = telemetry.retries;
+    doc["baud_downgrades"] = telemetry.baudDowngrades;
+    JsonObject adapt = doc["batching"].to<JsonObject>();
+    adapt["adaptive"] = ADAPTIVE_CHUNKS;
+    adapt["target"] = chunkCtl.target;
+    adapt["target_min"] = chunkCtl.minTarget;
+    adapt["target_max"] = chunkCtl.maxTarget;
+    adapt["changes"] = chunkCtl.changes;
+    adapt["flush_ms"] = chunkCtl.flushMs;
+    adapt["link_bps"] = (long)chunkCtl.rate;
+    adapt["write_us_per_kb"] = (long)(chunkCtl.writeUsPerByte * 1024);
+    adapt["max_write_us"] = chunkCtl.maxWriteUs;
+    JsonObject phases = doc["phases_ms"].to<JsonObject>();
+    for (int i = 0; i < TM_PHASES; i++) phases[TM_PHASE_NAMES[i]] = telemetry.phaseMs[i];
+
+    Serial.print("TELEMETRY ");
+    serializeJson(doc, Serial);
+    Serial.println();
+
+    // Keep one previous generation when the log grows past its cap
+    File f = STAGING_FS.open(TELEMETRY_PATH, FILE_READ);
+    bool rotate = f && f.size() > TELEMETRY_MAX_BYTES;
+    if (f) f.close();
+    if (rotate) {
+        String old = String(TELEMETRY_PATH) + ".1";
+        if (STAGING_FS.exists(old)) STAGING_FS.remove(old);
+        STAGING_FS.rename(TELEMETRY_PATH, old.c_str());
+    }
+    f = STAGING_FS.open(TELEMETRY_PATH, FILE_APPEND);
+    if (!f) return;
+    serializeJson(doc, f);
+    f.print("\n");
+    f.close();
+}
+
+void printProgress(size_t current, size_t total) {
+    Serial.printf("Downloading: %d%% (%ld B)\n", (int)((current * 100) / total), current);
+}
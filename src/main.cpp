@@ -2,31 +2,55 @@
 #include <Arduino.h>
 #include <WiFi.h>
 #include <WebServer.h>
-#include <SPIFFS.h>
 
 // ============================================================================
 // Forward Declarations
 // These tell main.cpp that these functions are defined in gsm.cpp
 // ============================================================================
+bool system_init();
 bool gsm_setup();
 void startDownload(); 
+bool gsm_begin(void (*onDone)(bool success), void (*onState)(const char* state));
+bool gsm_poll();
+void gsm_register_web(WebServer& server);
+void gsm_idle_sleep();
 
-// WebServer instance (optional - currently not used)
+// WebServer instance: shares the staged image and download progress
 WebServer server(80);
 
-// Network Credentials for SoftAP (optional, currently commented out)
-const char *ssid = "ESP32-S3-AccessPoint";
-const char *password = "12345678";
+// SoftAP credentials: set SOFTAP_SSID / SOFTAP_PASSWORD in platformio.ini
+// build_flags. Without them (or with a passphrase under the 8 characters
+// WPA2 needs) the AP stays off and nothing is served locally.
+#ifndef SOFTAP_SSID
+#define SOFTAP_SSID ""
+#endif
+#ifndef SOFTAP_PASSWORD
+#define SOFTAP_PASSWORD ""
+#endif
 
 // --- Handler Functions ---
 void handleRoot() {
-  server.send(200, "text/plain", "Welcome to ESP32-S3 SoftAP Server!");
+  server.send(200, "text/plain",
+              "Welcome to ESP32-S3 SoftAP Server!\n"
+              "GET /bootcode.bin  staged image (Range supported)\n"
+              "GET /progress      download status (JSON)\n");
 }
 
 void handleNotFound() {
   server.send(404, "text/plain", "404: Not Found");
 }
 
+// --- Downloader Callbacks (run from gsm_poll() in loop()) ---
+void onDownloadState(const char* state) {
+  Serial.printf("[downloader] %s\n", state);
+}
+
+void onDownloadDone(bool success) {
+  Serial.println("\n==============================================");
+  Serial.println(success ? "DOWNLOAD PROCESS COMPLETED" : "DOWNLOAD PROCESS FAILED");
+  Serial.println("==============================================\n");
+}
+
 void setup() {
   // Start Serial Monitor
   Serial.begin(115200);
@@ -34,50 +58,50 @@ void setup() {
 
   Serial.println("\n\n");
   Serial.println("==============================================");
-  Serial.println("ESP32-S3 FIRMWARE DOWNLOADER (SPIFFS)");
+  Serial.println("ESP32-S3 FIRMWARE DOWNLOADER");
   Serial.println("==============================================");
 
-  // Mount SPIFFS
-  // 'true' asks it to format if the file system is corrupted
-  if (!SPIFFS.begin(true)) {
-    Serial.println("✗ SPIFFS mount failed");
+  // Mount the staging filesystem (SPIFFS or LittleFS, see platformio.ini)
+  if (!system_init()) {
     Serial.println("System halted.");
     while(1) delay(1000);
-  } else {
-    Serial.println("✓ SPIFFS mounted successfully");
   }
 
-  // Optional: Setup SoftAP (currently commented out)
-  // WiFi.softAP(ssid, password);
-  // IPAddress IP = WiFi.softAPIP();
-  // Serial.print("AP IP: ");
-  // Serial.println(IP);
-  // server.on("/", handleRoot);
-  // server.onNotFound(handleNotFound);
-  // server.begin();
-
-  // Initialize and run GSM download with checksum
-  if (gsm_setup()) {
-    Serial.println("\n✓ GSM Setup Successful - Starting Download...\n");
-    
-    // ============================================================
-    // TRIGGER THE DOWNLOAD
-    // This calls the function inside gsm.cpp
-    // ============================================================
-    startDownload(); 
-
-    Serial.println("\n==============================================");
-    Serial.println("DOWNLOAD PROCESS COMPLETED");
-    Serial.println("==============================================\n");
+  // SoftAP: nearby units pull the image from here instead of over cellular
+  if (strlen(SOFTAP_SSID) == 0 || strlen(SOFTAP_PASSWORD) < 8) {
+    Serial.println("✗ SOFTAP_SSID / SOFTAP_PASSWORD not set (passphrase 8+ chars) - local sharing off");
+  } else if (!WiFi.softAP(SOFTAP_SSID, SOFTAP_PASSWORD)) {
+    Serial.println("✗ SoftAP failed to start - local sharing off");
   } else {
-    Serial.println("\n✗ GSM Setup Failed - Cannot download\n");
+    IPAddress IP = WiFi.softAPIP();
+    Serial.print("AP IP: ");
+    Serial.println(IP);
+    server.on("/", handleRoot);
+    gsm_register_web(server);
+    server.onNotFound(handleNotFound);
+    server.begin();
+  }
+
+  // ============================================================
+  // TRIGGER THE DOWNLOAD
+  // Modem power-up, attach, GET, read and verify run in a background
+  // task inside gsm.cpp; setup() returns straight away.
+  // (gsm_setup() + startDownload() remain for a blocking run.)
+  // ============================================================
+  if (!gsm_begin(onDownloadDone, onDownloadState)) {
+    Serial.println("\n✗ Could not start the downloader\n");
   }
 }
 
 void loop() {
-  // Optional: Handle web server requests if enabled
-  // server.handleClient();
-  
-  // Nothing to do after download completes
-  delay(10000);
+  // Reports downloader progress through the callbacks above
+  gsm_poll();
+
+  // Serve local clients while the download runs in its own task
+  server.handleClient();
+
+  // With scheduled checks enabled, deep sleeps once the run is over
+  gsm_idle_sleep();
+
+  delay(10);
 }
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+#include <AtChannel.h>
+#include <HttpHeaders.h>
+#include <QHttp.h>
+
+// A download over the QHTTP sequence in lib/ModemCore (QHttp), which
+// httpGet() / httpFetchToBuffer() / downloadAndVerify() in src/gsm.cpp run as
+// well. Only the body loop and storage here are the tests' own.
+
+// qhttpGet() on a fresh session unless one is carried over in s
+inline bool simHttpGet(AtChannel& ch, const char* url, const char* request, int& status, long& length, QHttpSession* s = NULL) {
+    QHttpSession fresh;
+    qhttpSessionReset(fresh);
+    return qhttpGet(ch, s ? *s : fresh, url, request, status, length);
+}
+
+// Reads the response after a successful simHttpGet(): headers into h, then
+// the body, the first cap bytes of it into body. Stops early after stopAfter
+// body bytes (-1 = never), as a download cut short would. Returns body bytes
+// read, -1 if no header block arrived.
+inline long simHttpRead(AtChannel& ch, HttpHeaderParser& h, uint8_t* body, long cap, long stopAfter = -1) {
+    CellLink& link = *ch.link;
+    QHttpSession s;
+    qhttpSessionReset(s);
+    if (!qhttpReadBegin(ch, s, 60, h, 10000) || h.contentLength < 0) return -1;
+
+    uint8_t buf[512];
+    long got = 0;
+    long want = stopAfter >= 0 && stopAfter < h.contentLength ? stopAfter : h.contentLength;
+    uint32_t lastAct = link.millis();
+    while (got < want) {
+        if (!link.waitForData(lastAct, 10000)) break;
+        size_t n = link.read(buf, want - got < (long)sizeof(buf) ? (size_t)(want - got) : sizeof(buf));
+        for (size_t i = 0; i < n && got + (long)i < cap; i++) body[got + i] = buf[i];
+        got += n;
+        lastAct = link.millis();
+    }
+    if (got == h.contentLength) qhttpReadEnd(ch);
+    return got;
+}
@@ -0,0 +1,346 @@
+#pragma once
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CellLink.h>
+
+// Simulated EC2x on the far end of a CellLink, serving the QHTTP transport on
+// a virtual clock so host tests run at full speed and come out the same every
+// time. Output leaves at baud / 10 bytes per second into a bounded RX ring
+// the way the UART driver fills it, dropping what does not fit unless flow
+// control is on. Waiting on the link is what moves the clock.
+#define SIM_OUT_ITEMS 8
+#define SIM_TEXT_MAX  256
+#define SIM_RAW_MAX   1024
+#define SIM_TICK_US   1000     // Clock step while the host waits for data
+
+struct SimConfig {
+    const char* url;           // Served; other URLs 404
+    const uint8_t* image;      // Body, NULL for simImageByte()
+    long imageSize;
+    const char* etag;          // Quoted, as sent in the ETag header
+    uint32_t baud;
+    uint32_t latencyMs;        // Before each response, ...
+    uint32_t jitterMs;         // ... plus up to this much at random
+    long dropoutEvery;         // Body bytes between radio stalls, 0 = none
+    uint32_t dropoutMs;
+    uint32_t urcInterval;      // ms between unsolicited +QIND lines, 0 = none
+    bool trailingOk;           // OK / +QHTTPREAD: 0 after the body, as the EC2x sends
+    size_t rxCap;              // Host RX ring
+    bool flowControl;          // RTS holds the modem off instead of overrunning
+};
+
+inline SimConfig simDefaults() {
+    SimConfig c;
+    c.url = "http://sim/bootcode.bin";
+    c.image = NULL;
+    c.imageSize = 512 * 1024;
+    c.etag = "\"sim-1\"";
+    c.baud = 921600;
+    c.latencyMs = 150;
+    c.jitterMs = 50;
+    c.dropoutEvery = 0;
+    c.dropoutMs = 700;
+    c.urcInterval = 0;
+    c.trailingOk = true;
+    c.rxCap = 8192;
+    c.flowControl = true;
+    return c;
+}
+
+// Deterministic image content when no image is given
+inline uint8_t simImageByte(long pos) {
+    return (uint8_t)(pos * 31 + (pos >> 9));
+}
+
+// One queued response: text, or a slice of the image
+struct SimOutItem {
+    char text[SIM_TEXT_MAX];
+    size_t len;
+    long bodyFrom;             // >= 0: len bytes of the image from here instead of text
+    size_t sent;
+    uint64_t readyAt;          // Clock (us) before which none of it goes out
+    uint32_t newBaud;          // Modem switches to this rate once the item is out (AT+IPR)
+};
+
+class SimModem : public CellLink {
+public:
+    explicit SimModem(const SimConfig& config) : cfg(config), modemBaud(config.baud), hostBaud(config.baud) {
+        rx = (uint8_t*)malloc(cfg.rxCap);
+    }
+    ~SimModem() { free(rx); }
+
+    using CellLink::read;
+    int available() override { return (int)rxLen; }
+
+    size_t read(uint8_t* buf, size_t len) override {
+        size_t n = len < rxLen ? len : rxLen;
+        for (size_t i = 0; i < n; i++) buf[i] = rx[(rxHead + i) % cfg.rxCap];
+        rxHead = (rxHead + n) % cfg.rxCap;
+        rxLen -= n;
+        return n;
+    }
+
+    // Host -> modem. A command line ends at CR (its LF is swallowed, so a
+    // payload requested by that command starts clean); payload bytes are counted.
+    size_t write(const uint8_t* buf, size_t len) override {
+        for (size_t i = 0; i < len; i++) {
+            char c = (char)buf[i];
+            if (skipLf && c == '\n') {
+                skipLf = false;
+                continue;
+            }
+            skipLf = false;
+            if (rawWant > 0) {
+                if (rawLen < SIM_RAW_MAX) raw[rawLen++] = c;
+                if (--rawWant == 0) {
+                    raw[rawLen] = 0;
+                    payload();
+                }
+                continue;
+            }
+            if (c == '\r' || c == '\n') {
+                if (cmdLen > 0) {
+                    cmd[cmdLen] = 0;
+                    command(cmd);
+                }
+                cmdLen = 0;
+                skipLf = c == '\r';
+            } else if (cmdLen < SIM_TEXT_MAX - 1) {
+                cmd[cmdLen++] = c;
+            }
+        }
+        return len;
+    }
+
+    void flush() override {}
+
+    bool waitForData(uint32_t start, uint32_t timeout) override {
+        deliver();
+        while (rxLen == 0) {
+            if (millis() - start >= timeout) return false;
+            advance(SIM_TICK_US);
+        }
+        return true;
+    }
+
+    uint32_t millis() override { return (uint32_t)(nowUs / 1000); }
+
+    // Moves the clock on by us, releasing whatever the line carries meanwhile
+    void advance(uint64_t us) {
+        nowUs += us;
+        deliver();
+    }
+
+    // The host UART's rate; bytes sent at another rate arrive as garbage
+    void setHostBaud(uint32_t baud) { hostBaud = baud; }
+
+    uint64_t nowUs = 0;
+    long dropped = 0;          // Bytes lost to RX ring overrun
+    int headerModeSets = 0;    // AT+QHTTPCFG="requestheader" commands seen
+    long bodySent = 0;
+    int lastStatus = 0;        // Of the most recent QHTTPGET
+    char lastRequest[SIM_RAW_MAX + 1] = "";  // Its custom header block
+
+private:
+    uint32_t latency() {
+        rng = rng * 1103515245u + 12345u;
+        return cfg.latencyMs + (cfg.jitterMs ? (rng >> 16) % cfg.jitterMs : 0);
+    }
+
+    uint8_t imageByte(long pos) { return cfg.image ? cfg.image[pos] : simImageByte(pos); }
+
+    void queueText(uint32_t delayMs, const char* fmt, ...) {
+        if (outCount == SIM_OUT_ITEMS) return;
+        SimOutItem& it = out[(outHead + outCount++) % SIM_OUT_ITEMS];
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(it.text, sizeof(it.text), fmt, args);
+        va_end(args);
+        it.len = n < 0 ? 0 : ((size_t)n < sizeof(it.text) ? (size_t)n : sizeof(it.text) - 1);
+        it.bodyFrom = -1;
+        it.sent = 0;
+        it.readyAt = nowUs + delayMs * 1000ull;
+        it.newBaud = 0;
+    }
+
+    void queueBody(long from, size_t len) {
+        if (outCount == SIM_OUT_ITEMS) return;
+        SimOutItem& it = out[(outHead + outCount++) % SIM_OUT_ITEMS];
+        it.len = len;
+        it.bodyFrom = from;
+        it.sent = 0;
+        it.readyAt = nowUs;
+        it.newBaud = 0;
+    }
+
+    // Answers one command line. Anything not modelled gets a plain OK.
+    void command(const char* line) {
+        uint32_t lat = latency();
+        long n = 0;
+        if (strncmp(line, "AT", 2) != 0) {
+            queueText(lat, "\r\nERROR\r\n");
+        } else if (sscanf(line, "AT+QHTTPURL=%ld", &n) == 1) {
+            queueText(lat, "\r\nCONNECT\r\n");
+            rawIsUrl = true;
+        } else if (sscanf(line, "AT+QHTTPGET=%*d,%ld", &n) == 1) {
+            queueText(lat, "\r\nCONNECT\r\n");
+            rawIsUrl = false;
+        } else if (strncmp(line, "AT+QHTTPGET", 11) == 0) {
+            respond("");
+        } else if (strncmp(line, "AT+QHTTPCFG=\"requestheader\"", 27) == 0) {
+            headerModeSets++;
+            queueText(lat, "\r\nOK\r\n");
+        } else if (strncmp(line, "AT+QHTTPREAD", 12) == 0) {
+            if (status != 200 && status != 206) {
+                queueText(lat, "\r\n+CME ERROR: 703\r\n");
+                return;
+            }
+            queueText(lat, "\r\nCONNECT\r\n");
+            char range[64] = "";
+            if (status == 206) {
+                snprintf(range, sizeof(range), "Content-Range: bytes %ld-%ld/%ld\r\n",
+                         respFrom, respFrom + respLen - 1, cfg.imageSize);
+            }
+            queueText(0, "HTTP/1.1 %d %s\r\nContent-Length: %ld\r\nETag: %s\r\n%sAccept-Ranges: bytes\r\n\r\n",
+                      status, status == 206 ? "Partial Content" : "OK", respLen, cfg.etag, range);
+            queueBody(respFrom, respLen);
+            if (cfg.trailingOk) queueText(0, "\r\nOK\r\n\r\n+QHTTPREAD: 0\r\n");
+            respLen = 0;
+            status = 0;
+        } else if (strcmp(line, "AT+CPIN?") == 0) {
+            queueText(lat, "\r\n+CPIN: READY\r\n\r\nOK\r\n");
+        } else if (strcmp(line, "AT+CEREG?") == 0 || strcmp(line, "AT+CGREG?") == 0) {
+            queueText(lat, "\r\n%.6s: 0,1\r\n\r\nOK\r\n", line + 2);
+        } else if (strcmp(line, "AT+QIACT?") == 0) {
+            if (pdpActive) queueText(lat, "\r\n+QIACT: 1,1,1,\"10.64.0.2\"\r\n\r\nOK\r\n");
+            else queueText(lat, "\r\nOK\r\n");
+        } else if (strcmp(line, "AT+QIACT=1") == 0) {
+            pdpActive = true;
+            queueText(lat * 4, "\r\nOK\r\n");
+        } else if (strncmp(line, "AT+QIDEACT", 10) == 0) {
+            pdpActive = false;
+            queueText(lat, "\r\nOK\r\n");
+        } else if (strcmp(line, "AT+CSQ") == 0) {
+            queueText(lat, "\r\n+CSQ: 21,99\r\n\r\nOK\r\n");
+        } else if (sscanf(line, "AT+IPR=%ld", &n) == 1) {
+            queueText(lat, "\r\nOK\r\n");
+            out[(outHead + outCount - 1) % SIM_OUT_ITEMS].newBaud = n;
+        } else {
+            queueText(lat, "\r\nOK\r\n");
+        }
+        if (n > 0 && strncmp(line, "AT+QHTTP", 8) == 0) {
+            rawLen = 0;
+            rawWant = n;
+        }
+    }
+
+    // QHTTPURL / QHTTPGET payload complete
+    void payload() {
+        if (rawIsUrl) {
+            strcpy(url, raw);
+            queueText(latency(), "\r\nOK\r\n");
+        } else {
+            respond(raw);
+        }
+    }
+
+    // Result of a QHTTPGET for url; request is the custom header block, if any.
+    void respond(const char* request) {
+        uint32_t lat = latency();
+        strcpy(lastRequest, request);
+        const char* range = strstr(request, "Range: bytes=");
+        respFrom = range ? atol(range + 13) : 0;
+        respLen = cfg.imageSize - respFrom;
+
+        if (strcmp(url, cfg.url) != 0) status = 404;
+        else if (strstr(request, "If-None-Match: ") && strstr(request, cfg.etag)) status = 304;
+        else if (respFrom >= cfg.imageSize) status = 416;
+        else status = range ? 206 : 200;
+        if (status != 200 && status != 206) respLen = 0;
+        lastStatus = status;
+
+        queueText(lat, "\r\nOK\r\n");
+        // The server round trip dominates, so charge it a few latencies
+        queueText(lat * 3, "\r\n+QHTTPGET: 0,%d,%ld\r\n", status, respLen);
+    }
+
+    // Releases output at modemBaud / 10 bytes per second since the last call
+    void deliver() {
+        bool streaming = false;
+        for (int i = 0; i < outCount; i++) streaming |= out[(outHead + i) % SIM_OUT_ITEMS].bodyFrom >= 0;
+        if (cfg.urcInterval && !streaming && rawWant == 0 && nowUs - lastUrcUs >= cfg.urcInterval * 1000ull) {
+            lastUrcUs = nowUs;
+            queueText(0, "\r\n+QIND: \"csq\",21,99\r\n");
+        }
+
+        credit += (nowUs - lastDeliverUs) * (modemBaud / 10.0) / 1000000.0;
+        lastDeliverUs = nowUs;
+        if (credit > cfg.rxCap) credit = cfg.rxCap;  // An idle line does not bank bytes
+
+        while (credit >= 1 && outCount > 0) {
+            SimOutItem& it = out[outHead];
+            if (nowUs < it.readyAt) break;
+            bool body = it.bodyFrom >= 0;
+            if (body && nowUs < stallUntilUs) break;
+
+            size_t n = it.len - it.sent;
+            if (n > (size_t)credit) n = (size_t)credit;
+            if (body && cfg.dropoutEvery > 0) {
+                size_t toStall = (size_t)(cfg.dropoutEvery - bodySent % cfg.dropoutEvery);
+                if (n > toStall) n = toStall;
+            }
+            if (cfg.flowControl && n > cfg.rxCap - rxLen) n = cfg.rxCap - rxLen;
+            if (n == 0) break;
+
+            for (size_t i = 0; i < n; i++) {
+                uint8_t c = body ? imageByte(it.bodyFrom + it.sent + i) : (uint8_t)it.text[it.sent + i];
+                if (hostBaud != modemBaud) c = 0xF0;  // Framing garbage
+                if (rxLen == cfg.rxCap) {
+                    dropped++;
+                    continue;
+                }
+                rx[(rxHead + rxLen++) % cfg.rxCap] = c;
+            }
+
+            credit -= n;
+            it.sent += n;
+            if (body) {
+                bodySent += n;
+                if (cfg.dropoutEvery > 0 && bodySent % cfg.dropoutEvery == 0) stallUntilUs = nowUs + cfg.dropoutMs * 1000ull;
+            }
+            if (it.sent == it.len) {
+                if (it.newBaud) modemBaud = it.newBaud;
+                outHead = (outHead + 1) % SIM_OUT_ITEMS;
+                outCount--;
+            }
+        }
+    }
+
+    SimConfig cfg;
+    uint32_t modemBaud;
+    uint32_t hostBaud;
+    uint32_t rng = 1;
+    uint8_t* rx;
+    size_t rxHead = 0, rxLen = 0;
+
+    char cmd[SIM_TEXT_MAX];    // Line being written by the host
+    size_t cmdLen = 0;
+    bool skipLf = false;
+    char raw[SIM_RAW_MAX + 1]; // QHTTPURL / QHTTPGET payload after CONNECT
+    size_t rawLen = 0;
+    long rawWant = 0;
+    bool rawIsUrl = false;
+
+    SimOutItem out[SIM_OUT_ITEMS];
+    int outHead = 0, outCount = 0;
+    uint64_t lastDeliverUs = 0;
+    double credit = 0;
+    uint64_t stallUntilUs = 0;
+    uint64_t lastUrcUs = 0;
+    bool pdpActive = false;
+    char url[SIM_RAW_MAX + 1] = "";
+    int status = 0;
+    long respFrom = 0, respLen = 0;
+};
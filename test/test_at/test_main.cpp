@@ -0,0 +1,203 @@
+#include <unity.h>
+#include <AtChannel.h>
+#include "../sim/SimModem.h"
+
+// Replays a fixed byte string, then goes quiet
+class ScriptLink : public CellLink {
+public:
+    explicit ScriptLink(const char* s) : script(s), pos(0), now(0) {}
+    using CellLink::read;
+    int available() override { return (int)(strlen(script) - pos); }
+    size_t read(uint8_t* buf, size_t len) override {
+        size_t n = 0;
+        while (n < len && script[pos]) buf[n++] = (uint8_t)script[pos++];
+        return n;
+    }
+    size_t write(const uint8_t*, size_t len) override { return len; }
+    void flush() override {}
+    bool waitForData(uint32_t start, uint32_t timeout) override {
+        if (available()) return true;
+        now = start + timeout;
+        return false;
+    }
+    uint32_t millis() override { return now; }
+
+    const char* script;
+    size_t pos;
+    uint32_t now;
+};
+
+static int urcCount;
+static char urcLine[AT_LINE_MAX];
+
+static void onQind(const char* line) {
+    urcCount++;
+    strcpy(urcLine, line);
+}
+
+void setUp() {
+    urcCount = 0;
+    urcLine[0] = 0;
+}
+
+void tearDown() {}
+
+static int feedAll(AtParser& p, const char* s, char lines[][AT_LINE_MAX], int maxLines) {
+    int n = 0;
+    for (; *s; s++) {
+        if (atFeed(p, *s) && n < maxLines) strcpy(lines[n++], p.line);
+    }
+    return n;
+}
+
+static void test_feed_strips_line_endings_and_skips_blank_lines() {
+    AtParser p = {};
+    char lines[4][AT_LINE_MAX];
+    int n = feedAll(p, "\r\n+CSQ: 21,99\r\n\r\nOK\r\n", lines, 4);
+    TEST_ASSERT_EQUAL_INT(2, n);
+    TEST_ASSERT_EQUAL_STRING("+CSQ: 21,99", lines[0]);
+    TEST_ASSERT_EQUAL_STRING("OK", lines[1]);
+}
+
+static void test_feed_accepts_bare_lf_and_split_input() {
+    AtParser p = {};
+    char lines[2][AT_LINE_MAX];
+    TEST_ASSERT_EQUAL_INT(0, feedAll(p, "+QIACT: 1,1", lines, 2));
+    TEST_ASSERT_EQUAL_INT(1, feedAll(p, ",1\n", lines, 2));
+    TEST_ASSERT_EQUAL_STRING("+QIACT: 1,1,1", lines[0]);
+}
+
+static void test_feed_truncates_overlong_line() {
+    AtParser p = {};
+    for (int i = 0; i < AT_LINE_MAX * 2; i++) TEST_ASSERT_FALSE(atFeed(p, 'x'));
+    TEST_ASSERT_TRUE(p.overflow);
+    TEST_ASSERT_TRUE(atFeed(p, '\n'));
+    TEST_ASSERT_EQUAL_size_t(AT_LINE_MAX - 1, strlen(p.line));
+    TEST_ASSERT_FALSE(p.overflow);
+    // The next line starts clean
+    char lines[1][AT_LINE_MAX];
+    TEST_ASSERT_EQUAL_INT(1, feedAll(p, "OK\r\n", lines, 1));
+    TEST_ASSERT_EQUAL_STRING("OK", lines[0]);
+}
+
+static void test_classify() {
+    TEST_ASSERT_EQUAL_INT(AT_LINE_OK, atClassify("OK"));
+    TEST_ASSERT_EQUAL_INT(AT_LINE_ERROR, atClassify("ERROR"));
+    TEST_ASSERT_EQUAL_INT(AT_LINE_ERROR, atClassify("+CME ERROR: 703"));
+    TEST_ASSERT_EQUAL_INT(AT_LINE_ERROR, atClassify("+CMS ERROR: 500"));
+    TEST_ASSERT_EQUAL_INT(AT_LINE_CONNECT, atClassify("CONNECT"));
+    TEST_ASSERT_EQUAL_INT(AT_LINE_CONNECT, atClassify("CONNECT 115200"));
+    TEST_ASSERT_EQUAL_INT(AT_LINE_URC, atClassify("+QIND: \"csq\",21,99"));
+    TEST_ASSERT_EQUAL_INT(AT_LINE_URC, atClassify("+QHTTPGET: 0,200,1024"));
+    TEST_ASSERT_EQUAL_INT(AT_LINE_URC, atClassify("RDY"));
+    TEST_ASSERT_EQUAL_INT(AT_LINE_INFO, atClassify("+CSQ: 21,99"));
+    TEST_ASSERT_EQUAL_INT(AT_LINE_INFO, atClassify("OKAY"));
+}
+
+static void test_wait_for_leaves_data_after_connect_unread() {
+    ScriptLink link("\r\nCONNECT\r\nHTTP/1.1 200 OK\r\n");
+    AtChannel ch = { &link, {}, {} };
+    TEST_ASSERT_EQUAL_INT(AT_MATCH, atWaitFor(ch, "CONNECT", 1000, true));
+    TEST_ASSERT_EQUAL_STRING("CONNECT", ch.parser.line);
+    TEST_ASSERT_EQUAL_STRING("HTTP/1.1 200 OK\r\n", link.script + link.pos);
+}
+
+static void test_wait_for_final_results() {
+    ScriptLink ok("\r\nOK\r\n");
+    AtChannel a = { &ok, {}, {} };
+    TEST_ASSERT_EQUAL_INT(AT_OK, atWaitFor(a, "+CSQ:", 1000, true));
+
+    ScriptLink err("\r\n+CME ERROR: 10\r\n");
+    AtChannel b = { &err, {}, {} };
+    TEST_ASSERT_EQUAL_INT(AT_ERROR, atWaitFor(b, "+CPIN:", 1000, true));
+    TEST_ASSERT_EQUAL_STRING("+CME ERROR: 10", b.parser.line);
+
+    ScriptLink quiet("");
+    AtChannel c = { &quiet, {}, {} };
+    TEST_ASSERT_EQUAL_INT(AT_TIMEOUT, atWaitFor(c, "OK", 1000, true));
+    TEST_ASSERT_EQUAL_UINT32(1000, quiet.now);
+}
+
+static void test_wait_for_dispatches_urcs_on_the_way() {
+    ScriptLink link("\r\n+QIND: \"csq\",21,99\r\n\r\n+QIND: \"act\",\"LTE\"\r\n\r\n+CSQ: 21,99\r\n");
+    AtChannel ch = {};
+    ch.link = &link;
+    TEST_ASSERT_TRUE(atOnUrc(ch, "+QIND:", onQind));
+    TEST_ASSERT_EQUAL_INT(AT_MATCH, atWaitFor(ch, "+CSQ:", 1000, true));
+    TEST_ASSERT_EQUAL_INT(2, urcCount);
+    TEST_ASSERT_EQUAL_STRING("+QIND: \"act\",\"LTE\"", urcLine);
+}
+
+static void test_urc_slots() {
+    AtChannel ch = {};
+    static const char* const prefixes[AT_URC_SLOTS] = { "+A:", "+B:", "+C:", "+D:" };
+    for (int i = 0; i < AT_URC_SLOTS; i++) TEST_ASSERT_TRUE(atOnUrc(ch, prefixes[i], onQind));
+    TEST_ASSERT_FALSE(atOnUrc(ch, "+E:", onQind));
+    TEST_ASSERT_TRUE(atOnUrc(ch, "+B:", onQind));  // Re-registering reuses the slot
+    TEST_ASSERT_TRUE(atDispatchUrc(ch, "+C: 1"));
+    TEST_ASSERT_FALSE(atDispatchUrc(ch, "+E: 1"));
+    TEST_ASSERT_EQUAL_INT(1, urcCount);
+}
+
+static void test_query_copies_the_prefixed_line() {
+    SimModem sim(simDefaults());
+    AtChannel ch = { &sim, {}, {} };
+    char csq[32];
+    TEST_ASSERT_TRUE(atQuery(ch, "AT+CSQ", "+CSQ:", csq, sizeof(csq), 1000));
+    TEST_ASSERT_EQUAL_STRING("+CSQ: 21,99", csq);
+    TEST_ASSERT_EQUAL_INT(0, sim.available());  // Final OK consumed
+
+    char act[32];
+    TEST_ASSERT_FALSE(atQuery(ch, "AT+QIACT?", "+QIACT:", act, sizeof(act), 1000));
+}
+
+// The EC2x ends an answer with OK after the intermediate line. Left unread,
+// that OK satisfies the next command's wait before its own answer arrives.
+static void test_send_eats_the_trailing_ok() {
+    SimModem sim(simDefaults());
+    AtChannel ch = { &sim, {}, {} };
+    TEST_ASSERT_TRUE(atSend(ch, "AT+CPIN?", "+CPIN: READY", 1000));
+    TEST_ASSERT_EQUAL_INT(0, sim.available());
+
+    // AT+QIACT=1 answers after four latencies; a stale OK would match at once
+    uint32_t sent = sim.millis();
+    TEST_ASSERT_TRUE(atSend(ch, "AT+QIACT=1", "OK", 5000));
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(4 * simDefaults().latencyMs, sim.millis() - sent);
+}
+
+static void test_stale_ok_without_eating_it() {
+    SimModem sim(simDefaults());
+    AtChannel ch = { &sim, {}, {} };
+    sim.println("AT+CPIN?");
+    TEST_ASSERT_EQUAL_INT(AT_MATCH, atWaitFor(ch, "+CPIN: READY", 1000, true));
+    // Skipping atSend()'s clean-up: the leftover OK answers the next command
+    uint32_t sent = sim.millis();
+    sim.println("AT+QIACT=1");
+    TEST_ASSERT_EQUAL_INT(AT_MATCH, atWaitFor(ch, "OK", 5000, true));
+    TEST_ASSERT_LESS_THAN_UINT32(simDefaults().latencyMs, sim.millis() - sent);
+}
+
+static void test_send_fails_early_on_error() {
+    SimModem sim(simDefaults());
+    AtChannel ch = { &sim, {}, {} };
+    uint32_t sent = sim.millis();
+    TEST_ASSERT_FALSE(atSend(ch, "XYZ", "OK", 60000));
+    TEST_ASSERT_LESS_THAN_UINT32(1000, sim.millis() - sent);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_feed_strips_line_endings_and_skips_blank_lines);
+    RUN_TEST(test_feed_accepts_bare_lf_and_split_input);
+    RUN_TEST(test_feed_truncates_overlong_line);
+    RUN_TEST(test_classify);
+    RUN_TEST(test_wait_for_leaves_data_after_connect_unread);
+    RUN_TEST(test_wait_for_final_results);
+    RUN_TEST(test_wait_for_dispatches_urcs_on_the_way);
+    RUN_TEST(test_urc_slots);
+    RUN_TEST(test_query_copies_the_prefixed_line);
+    RUN_TEST(test_send_eats_the_trailing_ok);
+    RUN_TEST(test_stale_ok_without_eating_it);
+    RUN_TEST(test_send_fails_early_on_error);
+    return UNITY_END();
+}
@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#include <DeltaPatch.h>
+
+#define BASE_SIZE 4096
+#define WINDOW    16           // Small, so every test crosses window refills
+
+static uint8_t base[BASE_SIZE];
+static uint8_t window[WINDOW];
+static long baseReads;
+
+static uint8_t patch[16384];
+static size_t patchLen;
+
+static uint8_t out[16384];
+static size_t outLen;
+
+static bool readBase(void* ctx, long pos, uint8_t* buf, size_t len) {
+    baseReads++;
+    memcpy(buf, (const uint8_t*)ctx + pos, len);
+    return true;
+}
+
+static bool collect(void*, const uint8_t* data, size_t len) {
+    if (outLen + len > sizeof(out)) return false;
+    memcpy(out + outLen, data, len);
+    outLen += len;
+    return true;
+}
+
+static void put32(uint32_t v) {
+    for (int i = 0; i < 4; i++) patch[patchLen++] = (uint8_t)(v >> (8 * i));
+}
+
+// Header; the target digest is the caller's to check, so it stays zero here
+static void header(uint32_t targetSize) {
+    patchLen = 0;
+    put32(DELTA_MAGIC);
+    put32(targetSize);
+    memset(patch + patchLen, 0, 32);
+    patchLen += 32;
+}
+
+// diffLen base bytes from the current position with delta added, then
+// extra, then seek
+static void record(uint32_t diffLen, uint8_t delta, const char* extra, int32_t seek) {
+    uint32_t extraLen = extra ? strlen(extra) : 0;
+    put32(diffLen);
+    put32(extraLen);
+    put32((uint32_t)seek);
+    for (uint32_t i = 0; i < diffLen; i++) patch[patchLen++] = delta;
+    if (extraLen) memcpy(patch + patchLen, extra, extraLen);
+    patchLen += extraLen;
+}
+
+static DeltaPatcher d;
+
+void setUp() {
+    for (int i = 0; i < BASE_SIZE; i++) base[i] = (uint8_t)(i * 7 + (i >> 8));
+    deltaInit(d, readBase, base, BASE_SIZE, window, WINDOW);
+    baseReads = 0;
+    outLen = 0;
+}
+
+void tearDown() {}
+
+static void feedWhole() {
+    TEST_ASSERT_TRUE(deltaFeed(d, collect, NULL, patch, patchLen));
+}
+
+// base[100..300) + 1, "NEW", then base[1000..1100) unchanged
+static void buildEdit() {
+    header(200 + 3 + 100);
+    record(0, 0, NULL, 100);
+    record(200, 1, "NEW", 1000 - 300);
+    record(100, 0, NULL, 0);
+}
+
+static void checkEdit() {
+    TEST_ASSERT_EQUAL_size_t(303, outLen);
+    for (int i = 0; i < 200; i++) TEST_ASSERT_EQUAL_INT((uint8_t)(base[100 + i] + 1), out[i]);
+    TEST_ASSERT_EQUAL_MEMORY("NEW", out + 200, 3);
+    TEST_ASSERT_EQUAL_MEMORY(base + 1000, out + 203, 100);
+}
+
+static void test_applies_diff_extra_and_seek() {
+    buildEdit();
+    feedWhole();
+    TEST_ASSERT_TRUE(deltaComplete(d));
+    TEST_ASSERT_NULL(d.error);
+    checkEdit();
+    TEST_ASSERT_GREATER_OR_EQUAL_INT(300 / WINDOW, baseReads);
+}
+
+static void test_any_split_gives_the_same_image() {
+    buildEdit();
+    for (size_t piece = 1; piece <= 50; piece += 7) {
+        setUp();
+        for (size_t pos = 0; pos < patchLen; pos += piece) {
+            size_t n = patchLen - pos < piece ? patchLen - pos : piece;
+            TEST_ASSERT_TRUE(deltaFeed(d, collect, NULL, patch + pos, n));
+        }
+        TEST_ASSERT_TRUE(deltaComplete(d));
+        checkEdit();
+    }
+}
+
+static void test_negative_seek_and_record_without_extra() {
+    // base[2000..2010), then back to base[0..10)
+    header(20);
+    record(0, 0, NULL, 2000);
+    record(10, 0, NULL, -2010);
+    record(10, 0, NULL, 0);
+    feedWhole();
+    TEST_ASSERT_TRUE(deltaComplete(d));
+    TEST_ASSERT_EQUAL_MEMORY(base + 2000, out, 10);
+    TEST_ASSERT_EQUAL_MEMORY(base, out + 10, 10);
+}
+
+static void test_extra_only_patch() {
+    header(5);
+    record(0, 0, "hello", 0);
+    feedWhole();
+    TEST_ASSERT_TRUE(deltaComplete(d));
+    TEST_ASSERT_EQUAL_MEMORY("hello", out, 5);
+    TEST_ASSERT_EQUAL_INT(0, baseReads);
+}
+
+static void test_empty_target() {
+    header(0);
+    feedWhole();
+    TEST_ASSERT_TRUE(deltaComplete(d));
+    TEST_ASSERT_EQUAL_size_t(0, outLen);
+}
+
+static void test_truncated_patch_is_incomplete() {
+    buildEdit();
+    TEST_ASSERT_TRUE(deltaFeed(d, collect, NULL, patch, patchLen - 10));
+    TEST_ASSERT_FALSE(deltaComplete(d));
+}
+
+static void test_rejects_bad_magic() {
+    buildEdit();
+    patch[0] = 'X';
+    TEST_ASSERT_FALSE(deltaFeed(d, collect, NULL, patch, patchLen));
+    TEST_ASSERT_EQUAL_STRING("Not a delta patch", d.error);
+}
+
+static void test_rejects_overrun() {
+    header(10);
+    record(0, 0, "more than ten bytes", 0);
+    TEST_ASSERT_FALSE(deltaFeed(d, collect, NULL, patch, patchLen));
+    TEST_ASSERT_EQUAL_STRING("Patch overruns target size", d.error);
+}
+
+// diffLen + extraLen wraps to 4 in 32 bits; still more than the target holds
+static void test_rejects_wrapping_control_record() {
+    header(10);
+    put32(0xFFFFFFFCu);
+    put32(8);
+    put32(0);
+    TEST_ASSERT_FALSE(deltaFeed(d, collect, NULL, patch, patchLen));
+    TEST_ASSERT_EQUAL_STRING("Patch overruns target size", d.error);
+    TEST_ASSERT_EQUAL_size_t(0, outLen);
+}
+
+static void test_rejects_reads_past_the_base() {
+    header(20);
+    record(0, 0, NULL, BASE_SIZE - 10);
+    record(10, 0, NULL, 0);
+    record(10, 0, NULL, 0);  // Starts at BASE_SIZE
+    TEST_ASSERT_FALSE(deltaFeed(d, collect, NULL, patch, patchLen));
+    TEST_ASSERT_EQUAL_STRING("Patch reads past the end of the base image", d.error);
+
+    setUp();
+    header(4);
+    record(0, 0, NULL, -1);
+    record(4, 0, NULL, 0);   // Starts before the base
+    TEST_ASSERT_FALSE(deltaFeed(d, collect, NULL, patch, patchLen));
+    TEST_ASSERT_EQUAL_STRING("Patch reads past the end of the base image", d.error);
+}
+
+static void test_sink_failure_stops_the_patch() {
+    header(10000);
+    for (int i = 0; i < 10; i++) record(1000, 0, NULL, -1000);
+    outLen = sizeof(out) - 100;  // Sink fills up part way
+    TEST_ASSERT_FALSE(deltaFeed(d, collect, NULL, patch, patchLen));
+    TEST_ASSERT_NULL(d.error);
+}
+
+// The device asks for deltaPatchName(sha256(base file)); mkpatch.py writes
+// patch_name(old). Both must give hashlib.sha256(b"abc").hexdigest() + ".patch"
+// for this digest of "abc".
+static void test_patch_name_is_the_base_sha256() {
+    static const uint8_t sha[32] = {
+        0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+        0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad
+    };
+    char name[DELTA_NAME_LEN];
+    deltaPatchName(sha, name, sizeof(name));
+    TEST_ASSERT_EQUAL_STRING("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad.patch", name);
+
+    char small[DELTA_NAME_LEN - 1];
+    deltaPatchName(sha, small, sizeof(small));
+    TEST_ASSERT_EQUAL_STRING("", small);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_applies_diff_extra_and_seek);
+    RUN_TEST(test_any_split_gives_the_same_image);
+    RUN_TEST(test_negative_seek_and_record_without_extra);
+    RUN_TEST(test_extra_only_patch);
+    RUN_TEST(test_empty_target);
+    RUN_TEST(test_truncated_patch_is_incomplete);
+    RUN_TEST(test_rejects_bad_magic);
+    RUN_TEST(test_rejects_overrun);
+    RUN_TEST(test_rejects_wrapping_control_record);
+    RUN_TEST(test_rejects_reads_past_the_base);
+    RUN_TEST(test_sink_failure_stops_the_patch);
+    RUN_TEST(test_patch_name_is_the_base_sha256);
+    return UNITY_END();
+}
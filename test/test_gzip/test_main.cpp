@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#include <GzipStream.h>
+
+// gzip -9 of patternByte(0..99999), no optional header fields
+static const uint8_t GZ_PATTERN[] = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0xed, 0xcb, 0x59, 0x36, 0x02, 0x00,
+    0x14, 0x00, 0xd0, 0x0c, 0x99, 0x32, 0x4f, 0x99, 0x33, 0xcf, 0x54, 0x22, 0x52, 0x88, 0x10, 0xda,
+    0xff, 0x7e, 0x5a, 0xc4, 0x3b, 0xce, 0xfb, 0xb9, 0xf7, 0xff, 0x16, 0x46, 0x46, 0xc7, 0xc6, 0x8b,
+    0x13, 0x93, 0x53, 0xd3, 0x33, 0xa5, 0xd9, 0xb9, 0xf9, 0x85, 0xc5, 0xa5, 0xe5, 0x95, 0xd5, 0xb5,
+    0xf5, 0xf2, 0xc6, 0xe6, 0xd6, 0xf6, 0xce, 0xee, 0x5e, 0x65, 0xff, 0xe0, 0xf0, 0xe8, 0xf8, 0xe4,
+    0xf4, 0xec, 0xfc, 0xe2, 0xf2, 0xea, 0xfa, 0xe6, 0xb6, 0x5a, 0xab, 0xdf, 0x35, 0xee, 0x1f, 0x9a,
+    0x8f, 0x4f, 0xad, 0xe7, 0x76, 0xe7, 0xe5, 0xf5, 0xad, 0xe0, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef,
+    0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb,
+    0x7e, 0xfa, 0x0f, 0xf6, 0xae, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb,
+    0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xf9, 0x3f, 0xd8, 0xdf,
+    0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d,
+    0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xcf, 0xff, 0xc1, 0xfe, 0xe1, 0xfb, 0xbe, 0xef, 0xfb,
+    0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe,
+    0xef, 0xfb, 0x7e, 0xfe, 0x0f, 0xf6, 0x9e, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe,
+    0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xf9, 0x3f,
+    0xd8, 0x3f, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf,
+    0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xcf, 0xff, 0xc1, 0xfe, 0xe5, 0xfb, 0xbe,
+    0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef,
+    0xfb, 0xbe, 0xef, 0xfb, 0x7e, 0xfe, 0x0f, 0xf6, 0x6f, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf,
+    0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7,
+    0xf3, 0x7f, 0xb0, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7,
+    0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xcf, 0xff, 0xc1, 0xfe, 0xe3,
+    0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb,
+    0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0x7e, 0xfe, 0x0f, 0xf6, 0x5f, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7,
+    0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d, 0xdf, 0xf7, 0x7d,
+    0xdf, 0xf7, 0xf3, 0x7f, 0xb0, 0xff, 0xf9, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb,
+    0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0xef, 0xfb, 0xbe, 0x9f, 0xff, 0x83,
+    0x7d, 0xe0, 0xfb, 0xbe, 0xef, 0xfb, 0xff, 0xf1, 0x87, 0x40, 0xb5, 0xaf, 0x6a, 0xa0, 0x86, 0x01,
+    0x00,
+};
+
+// "The quick brown fox jumps over the lazy dog. " x 20 behind a header with
+// FEXTRA, FNAME, FCOMMENT and FHCRC all set
+static const uint8_t GZ_ALL_FLAGS[] = {
+    0x1f, 0x8b, 0x08, 0x1e, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x06, 0x00, 0x41, 0x42, 0x02, 0x00,
+    0x78, 0x79, 0x69, 0x6d, 0x67, 0x2e, 0x62, 0x69, 0x6e, 0x00, 0x62, 0x75, 0x69, 0x6c, 0x74, 0x20,
+    0x62, 0x79, 0x20, 0x74, 0x65, 0x73, 0x74, 0x00, 0x3d, 0x26, 0x0b, 0xc9, 0x48, 0x55, 0x28, 0x2c,
+    0xcd, 0x4c, 0xce, 0x56, 0x48, 0x2a, 0xca, 0x2f, 0xcf, 0x53, 0x48, 0xcb, 0xaf, 0x50, 0xc8, 0x2a,
+    0xcd, 0x2d, 0x28, 0x56, 0xc8, 0x2f, 0x4b, 0x2d, 0x52, 0x28, 0x01, 0x4a, 0xe7, 0x24, 0x56, 0x55,
+    0x2a, 0xa4, 0xe4, 0xa7, 0xeb, 0x29, 0x84, 0x8c, 0x2a, 0x1e, 0x55, 0x3c, 0xaa, 0x98, 0xda, 0x8a,
+    0x01, 0xe6, 0x4a, 0x66, 0xb0, 0x84, 0x03, 0x00, 0x00,
+};
+
+#define PATTERN_SIZE 100000
+
+static uint8_t patternByte(long i) {
+    return (uint8_t)((i % 64) + (i / 8192));
+}
+
+// Collects inflated output; fails the stream once full
+struct Sink {
+    uint8_t* data;
+    size_t len;
+    size_t cap;
+    size_t calls;
+};
+
+static bool collect(void* ctx, const uint8_t* data, size_t len) {
+    Sink* s = (Sink*)ctx;
+    if (s->len + len > s->cap) return false;
+    memcpy(s->data + s->len, data, len);
+    s->len += len;
+    s->calls++;
+    return true;
+}
+
+static GzipInflater* g;
+static Sink sink;
+
+void setUp() {
+    g = (GzipInflater*)malloc(sizeof(GzipInflater));
+    gzipInit(*g);
+    sink.cap = PATTERN_SIZE + 1024;
+    sink.data = (uint8_t*)malloc(sink.cap);
+    sink.len = 0;
+    sink.calls = 0;
+}
+
+void tearDown() {
+    free(g);
+    free(sink.data);
+}
+
+static void checkPattern() {
+    TEST_ASSERT_EQUAL_size_t(PATTERN_SIZE, sink.len);
+    for (long i = 0; i < PATTERN_SIZE; i++) {
+        if (sink.data[i] != patternByte(i)) TEST_FAIL_MESSAGE("inflated byte differs");
+    }
+}
+
+static void test_inflates_across_window_wraps() {
+    TEST_ASSERT_TRUE(gzipFeed(*g, collect, &sink, GZ_PATTERN, sizeof(GZ_PATTERN)));
+    TEST_ASSERT_TRUE(gzipComplete(*g));
+    TEST_ASSERT_NULL(g->error);
+    checkPattern();
+}
+
+static void test_byte_at_a_time() {
+    for (size_t i = 0; i < sizeof(GZ_PATTERN); i++) TEST_ASSERT_TRUE(gzipFeed(*g, collect, &sink, GZ_PATTERN + i, 1));
+    TEST_ASSERT_TRUE(gzipComplete(*g));
+    checkPattern();
+}
+
+static void test_skips_optional_header_fields() {
+    TEST_ASSERT_TRUE(gzipFeed(*g, collect, &sink, GZ_ALL_FLAGS, sizeof(GZ_ALL_FLAGS)));
+    TEST_ASSERT_TRUE(gzipComplete(*g));
+    TEST_ASSERT_EQUAL_size_t(45 * 20, sink.len);
+    TEST_ASSERT_EQUAL_MEMORY("The quick brown fox jumps over the lazy dog. The", sink.data, 48);
+
+    // Same again with the header split between every byte
+    gzipInit(*g);
+    sink.len = 0;
+    for (size_t i = 0; i < sizeof(GZ_ALL_FLAGS); i++) TEST_ASSERT_TRUE(gzipFeed(*g, collect, &sink, GZ_ALL_FLAGS + i, 1));
+    TEST_ASSERT_TRUE(gzipComplete(*g));
+    TEST_ASSERT_EQUAL_size_t(45 * 20, sink.len);
+}
+
+static void test_ignores_bytes_after_the_member() {
+    uint8_t* in = (uint8_t*)malloc(sizeof(GZ_ALL_FLAGS) + 16);
+    memcpy(in, GZ_ALL_FLAGS, sizeof(GZ_ALL_FLAGS));
+    memset(in + sizeof(GZ_ALL_FLAGS), 0xAA, 16);
+    TEST_ASSERT_TRUE(gzipFeed(*g, collect, &sink, in, sizeof(GZ_ALL_FLAGS) + 16));
+    TEST_ASSERT_TRUE(gzipComplete(*g));
+    TEST_ASSERT_EQUAL_size_t(45 * 20, sink.len);
+    free(in);
+}
+
+static void test_truncated_stream_is_incomplete() {
+    TEST_ASSERT_TRUE(gzipFeed(*g, collect, &sink, GZ_PATTERN, sizeof(GZ_PATTERN) - 5));
+    TEST_ASSERT_FALSE(gzipComplete(*g));
+}
+
+static void test_rejects_non_gzip() {
+    static const uint8_t zip[] = { 'P', 'K', 3, 4, 20, 0, 0, 0, 8, 0, 0, 0 };
+    TEST_ASSERT_FALSE(gzipFeed(*g, collect, &sink, zip, sizeof(zip)));
+    TEST_ASSERT_EQUAL_STRING("Not a gzip stream", g->error);
+}
+
+static void test_rejects_bad_crc() {
+    uint8_t* in = (uint8_t*)malloc(sizeof(GZ_PATTERN));
+    memcpy(in, GZ_PATTERN, sizeof(GZ_PATTERN));
+    in[sizeof(GZ_PATTERN) - 8] ^= 1;
+    TEST_ASSERT_FALSE(gzipFeed(*g, collect, &sink, in, sizeof(GZ_PATTERN)));
+    TEST_ASSERT_EQUAL_STRING("gzip CRC/size mismatch", g->error);
+    free(in);
+}
+
+static void test_rejects_corrupt_deflate_data() {
+    uint8_t* in = (uint8_t*)malloc(sizeof(GZ_ALL_FLAGS));
+    memcpy(in, GZ_ALL_FLAGS, sizeof(GZ_ALL_FLAGS));
+    size_t deflateAt = 10 + 2 + 6 + 8 + 14 + 2;
+    for (size_t i = deflateAt; i < deflateAt + 8; i++) in[i] ^= 0x5A;
+    TEST_ASSERT_FALSE(gzipFeed(*g, collect, &sink, in, sizeof(GZ_ALL_FLAGS)));
+    TEST_ASSERT_NOT_NULL(g->error);
+    TEST_ASSERT_FALSE(gzipComplete(*g));
+    free(in);
+}
+
+static void test_sink_failure_stops_the_stream() {
+    sink.cap = 1000;
+    TEST_ASSERT_FALSE(gzipFeed(*g, collect, &sink, GZ_PATTERN, sizeof(GZ_PATTERN)));
+    TEST_ASSERT_NULL(g->error);  // Not the stream's fault
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_inflates_across_window_wraps);
+    RUN_TEST(test_byte_at_a_time);
+    RUN_TEST(test_skips_optional_header_fields);
+    RUN_TEST(test_ignores_bytes_after_the_member);
+    RUN_TEST(test_truncated_stream_is_incomplete);
+    RUN_TEST(test_rejects_non_gzip);
+    RUN_TEST(test_rejects_bad_crc);
+    RUN_TEST(test_rejects_corrupt_deflate_data);
+    RUN_TEST(test_sink_failure_stops_the_stream);
+    return UNITY_END();
+}
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+#include <HttpHeaders.h>
+
+static const char S3_RESPONSE[] =
+    "HTTP/1.1 206 Partial Content\r\n"
+    "x-amz-request-id: 4Z1Q8V0Y2F0A\r\n"
+    "Last-Modified: Tue, 01 Oct 2024 10:00:00 GMT\r\n"
+    "ETag: \"6805f2cfc46c0f04559748bb039d69ae\"\r\n"
+    "accept-ranges: bytes\r\n"
+    "Content-Range: bytes 1000-1048575/1048576\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "content-length: 1047576\r\n"
+    "Server: AmazonS3\r\n"
+    "\r\n"
+    "BODY";
+
+void setUp() {}
+void tearDown() {}
+
+static void checkS3(const HttpHeaderParser& h) {
+    TEST_ASSERT_TRUE(h.done);
+    TEST_ASSERT_EQUAL_INT(206, h.status);
+    TEST_ASSERT_EQUAL_INT(1047576, h.contentLength);
+    TEST_ASSERT_EQUAL_INT(1048576, h.rangeTotal);
+    TEST_ASSERT_TRUE(h.acceptRanges);
+    TEST_ASSERT_EQUAL_STRING("\"6805f2cfc46c0f04559748bb039d69ae\"", h.validators.etag);
+    TEST_ASSERT_EQUAL_STRING("Tue, 01 Oct 2024 10:00:00 GMT", h.validators.lastModified);
+}
+
+static void test_parses_whole_block_and_stops_at_body() {
+    HttpHeaderParser h;
+    httpHeaderBegin(h);
+    size_t len = sizeof(S3_RESPONSE) - 1;
+    size_t used = httpHeaderFeed(h, (const uint8_t*)S3_RESPONSE, len);
+    TEST_ASSERT_EQUAL_size_t(len - 4, used);
+    checkS3(h);
+}
+
+static void test_same_result_in_any_split() {
+    size_t len = sizeof(S3_RESPONSE) - 1;
+    for (size_t piece = 1; piece <= 64; piece++) {
+        HttpHeaderParser h;
+        httpHeaderBegin(h);
+        size_t pos = 0;
+        while (pos < len && !h.done) {
+            size_t n = len - pos < piece ? len - pos : piece;
+            pos += httpHeaderFeed(h, (const uint8_t*)S3_RESPONSE + pos, n);
+        }
+        TEST_ASSERT_EQUAL_size_t(len - 4, pos);
+        checkS3(h);
+    }
+}
+
+static void test_defaults_when_headers_absent() {
+    static const char resp[] = "HTTP/1.1 304 Not Modified\r\n\r\n";
+    HttpHeaderParser h;
+    httpHeaderBegin(h);
+    httpHeaderFeed(h, (const uint8_t*)resp, sizeof(resp) - 1);
+    TEST_ASSERT_TRUE(h.done);
+    TEST_ASSERT_EQUAL_INT(304, h.status);
+    TEST_ASSERT_EQUAL_INT(-1, h.contentLength);
+    TEST_ASSERT_EQUAL_INT(-1, h.rangeTotal);
+    TEST_ASSERT_FALSE(h.acceptRanges);
+    TEST_ASSERT_EQUAL_STRING("", h.validators.etag);
+}
+
+static void test_bare_lf_line_endings() {
+    static const char resp[] = "HTTP/1.0 200 OK\nContent-Length: 12\n\nbody";
+    HttpHeaderParser h;
+    httpHeaderBegin(h);
+    size_t used = httpHeaderFeed(h, (const uint8_t*)resp, sizeof(resp) - 1);
+    TEST_ASSERT_EQUAL_size_t(sizeof(resp) - 1 - 4, used);
+    TEST_ASSERT_EQUAL_INT(200, h.status);
+    TEST_ASSERT_EQUAL_INT(12, h.contentLength);
+}
+
+static void test_accept_ranges_none() {
+    static const char resp[] = "HTTP/1.1 200 OK\r\nAccept-Ranges: none\r\n\r\n";
+    HttpHeaderParser h;
+    httpHeaderBegin(h);
+    httpHeaderFeed(h, (const uint8_t*)resp, sizeof(resp) - 1);
+    TEST_ASSERT_FALSE(h.acceptRanges);
+}
+
+static void test_oversized_block_gives_up() {
+    HttpHeaderParser h;
+    httpHeaderBegin(h);
+    static const char status[] = "HTTP/1.1 200 OK\r\n";
+    httpHeaderFeed(h, (const uint8_t*)status, sizeof(status) - 1);
+    uint8_t filler[100];
+    memset(filler, 'a', sizeof(filler));
+    filler[sizeof(filler) - 1] = '\n';
+    for (int i = 0; i < HTTP_HEADER_MAX / 100 + 1 && !h.done; i++) httpHeaderFeed(h, filler, sizeof(filler));
+    TEST_ASSERT_TRUE(h.done);
+    TEST_ASSERT_EQUAL_INT(0, h.status);  // Callers treat this as a failed response
+}
+
+static void test_overlong_validator_is_truncated() {
+    char resp[512];
+    char etag[200];
+    memset(etag, 'e', sizeof(etag) - 1);
+    etag[sizeof(etag) - 1] = 0;
+    snprintf(resp, sizeof(resp), "HTTP/1.1 200 OK\r\nETag: %s\r\n\r\n", etag);
+    HttpHeaderParser h;
+    httpHeaderBegin(h);
+    httpHeaderFeed(h, (const uint8_t*)resp, strlen(resp));
+    TEST_ASSERT_EQUAL_size_t(VALIDATOR_MAX - 1, strlen(h.validators.etag));
+}
+
+static void test_copy_header_value() {
+    char out[16] = "unchanged";
+    copyHeaderValue("Content-Type: text/plain", "ETag:", out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("unchanged", out);
+    copyHeaderValue("etag:    \"abc\"", "ETag:", out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("\"abc\"", out);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_parses_whole_block_and_stops_at_body);
+    RUN_TEST(test_same_result_in_any_split);
+    RUN_TEST(test_defaults_when_headers_absent);
+    RUN_TEST(test_bare_lf_line_endings);
+    RUN_TEST(test_accept_ranges_none);
+    RUN_TEST(test_oversized_block_gives_up);
+    RUN_TEST(test_overlong_validator_is_truncated);
+    RUN_TEST(test_copy_header_value);
+    return UNITY_END();
+}
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unity.h>
+#include <ResumePoint.h>
+#include "../sim/SimModem.h"
+#include "../sim/SimHttp.h"
+
+static const char* URL = "http://sim/bootcode.bin";
+static const uint32_t CTX = 224;  // Stands in for sizeof(StreamHash)
+
+void setUp() {}
+void tearDown() {}
+
+static void test_url_key_ignores_query() {
+    TEST_ASSERT_EQUAL_HEX32(urlKey("http://a/b.bin"), urlKey("http://a/b.bin?t=123"));
+    TEST_ASSERT_TRUE(urlKey("http://a/b.bin") != urlKey("http://a/c.bin"));
+    TEST_ASSERT_EQUAL_HEX32(2166136261u, urlKey(""));  // FNV-1a offset basis
+}
+
+static void test_valid_point_round_trips() {
+    ResumePoint r;
+    resumePointSet(r, URL, 4096, 65536, "\"v1\"", CTX);
+    TEST_ASSERT_TRUE(resumePointValid(r, "http://sim/bootcode.bin?t=99", CTX, 4096));
+    TEST_ASSERT_EQUAL_STRING("\"v1\"", r.etag);
+}
+
+static void test_rejects_mismatches() {
+    ResumePoint r;
+    resumePointSet(r, URL, 4096, 65536, "", CTX);
+    TEST_ASSERT_FALSE(resumePointValid(r, "http://sim/other.bin", CTX, 4096));
+    TEST_ASSERT_FALSE(resumePointValid(r, URL, CTX + 8, 4096));  // Other firmware's digest layout
+    TEST_ASSERT_FALSE(resumePointValid(r, URL, CTX, 4000));      // File shorter than the state
+    TEST_ASSERT_FALSE(resumePointValid(r, URL, CTX, -1));        // File gone
+
+    ResumePoint bad = r;
+    bad.magic ^= 1;
+    TEST_ASSERT_FALSE(resumePointValid(bad, URL, CTX, 4096));
+
+    resumePointSet(r, URL, 0, 65536, "", CTX);
+    TEST_ASSERT_FALSE(resumePointValid(r, URL, CTX, 0));
+    resumePointSet(r, URL, 65536, 65536, "", CTX);
+    TEST_ASSERT_FALSE(resumePointValid(r, URL, CTX, 65536));     // Nothing left to fetch
+}
+
+static void test_overlong_etag_is_truncated() {
+    char etag[VALIDATOR_MAX * 2];
+    memset(etag, 'e', sizeof(etag) - 1);
+    etag[sizeof(etag) - 1] = 0;
+    ResumePoint r;
+    resumePointSet(r, URL, 1, 2, etag, CTX);
+    TEST_ASSERT_EQUAL_size_t(VALIDATOR_MAX - 1, strlen(r.etag));
+}
+
+static void test_continues_only_on_matching_206() {
+    ResumePoint r;
+    resumePointSet(r, URL, 1000, 5000, "", CTX);
+    TEST_ASSERT_TRUE(resumeContinues(r, 206, 4000));
+    TEST_ASSERT_FALSE(resumeContinues(r, 200, 5000));  // Server ignored the Range
+    TEST_ASSERT_FALSE(resumeContinues(r, 206, 5000));  // File changed length
+    TEST_ASSERT_FALSE(resumeContinues(r, 416, 0));
+}
+
+// A download cut off part way, then continued on a fresh modem session with
+// Range / If-Range the way downloadAndVerify() builds them
+static void test_resumed_download_matches_image() {
+    SimConfig cfg = simDefaults();
+    cfg.imageSize = 96 * 1024;
+    long cut = 40000;
+    uint8_t* got = (uint8_t*)malloc(cfg.imageSize);
+
+    ResumePoint point;
+    {
+        SimModem sim(cfg);
+        AtChannel ch = { &sim, {}, {} };
+        int status;
+        long length;
+        HttpHeaderParser h;
+        TEST_ASSERT_TRUE(simHttpGet(ch, URL, NULL, status, length));
+        TEST_ASSERT_EQUAL_INT(200, status);
+        TEST_ASSERT_EQUAL_INT(cfg.imageSize, length);
+        TEST_ASSERT_EQUAL_INT(cut, simHttpRead(ch, h, got, cfg.imageSize, cut));
+        resumePointSet(point, URL, cut, h.contentLength, h.validators.etag, CTX);
+    }
+    TEST_ASSERT_TRUE(resumePointValid(point, URL, CTX, cut));
+
+    SimModem sim(cfg);
+    AtChannel ch = { &sim, {}, {} };
+    char request[256];
+    snprintf(request, sizeof(request), "GET /bootcode.bin HTTP/1.1\r\nHost: sim\r\nRange: bytes=%ld-\r\nIf-Range: %s\r\n\r\n",
+             point.offset, point.etag);
+    int status;
+    long length;
+    HttpHeaderParser h;
+    TEST_ASSERT_TRUE(simHttpGet(ch, URL, request, status, length));
+    TEST_ASSERT_EQUAL_INT(206, status);
+    TEST_ASSERT_TRUE(resumeContinues(point, status, length));
+    long rest = simHttpRead(ch, h, got + cut, cfg.imageSize - cut);
+    TEST_ASSERT_EQUAL_INT(cfg.imageSize - cut, rest);
+    TEST_ASSERT_EQUAL_INT(cfg.imageSize, h.rangeTotal);
+
+    for (long i = 0; i < cfg.imageSize; i++) {
+        if (got[i] != simImageByte(i)) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "byte %ld differs", i);
+            TEST_FAIL_MESSAGE(msg);
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(0, sim.dropped);
+    free(got);
+}
+
+// A resume point past the end of what the server now has starts over
+static void test_range_past_end_is_refused() {
+    SimConfig cfg = simDefaults();
+    cfg.imageSize = 1000;
+    SimModem sim(cfg);
+    AtChannel ch = { &sim, {}, {} };
+    int status;
+    long length;
+    TEST_ASSERT_TRUE(simHttpGet(ch, URL, "GET /bootcode.bin HTTP/1.1\r\nHost: sim\r\nRange: bytes=4000-\r\n\r\n", status, length));
+    TEST_ASSERT_EQUAL_INT(416, status);
+    ResumePoint r;
+    resumePointSet(r, URL, 4000, 5000, "", CTX);
+    TEST_ASSERT_FALSE(resumeContinues(r, status, length));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_url_key_ignores_query);
+    RUN_TEST(test_valid_point_round_trips);
+    RUN_TEST(test_rejects_mismatches);
+    RUN_TEST(test_overlong_etag_is_truncated);
+    RUN_TEST(test_continues_only_on_matching_206);
+    RUN_TEST(test_resumed_download_matches_image);
+    RUN_TEST(test_range_past_end_is_refused);
+    return UNITY_END();
+}
@@ -0,0 +1,80 @@
+#include <string.h>
+#include <unity.h>
+#include <Sha256Soft.h>
+
+void setUp() {}
+void tearDown() {}
+
+static void digestOf(const uint8_t* data, size_t len, size_t piece, uint8_t* out) {
+    Sha256Soft s;
+    sha256SoftInit(s);
+    for (size_t pos = 0; pos < len; pos += piece) sha256SoftUpdate(s, data + pos, len - pos < piece ? len - pos : piece);
+    sha256SoftFinish(s, out);
+}
+
+// FIPS 180-4 example vectors
+static void test_known_vectors() {
+    static const uint8_t empty[32] = {
+        0xe3, 0xb0, 0xc4, 0x42, 0x98, 0xfc, 0x1c, 0x14, 0x9a, 0xfb, 0xf4, 0xc8, 0x99, 0x6f, 0xb9, 0x24,
+        0x27, 0xae, 0x41, 0xe4, 0x64, 0x9b, 0x93, 0x4c, 0xa4, 0x95, 0x99, 0x1b, 0x78, 0x52, 0xb8, 0x55,
+    };
+    static const uint8_t abc[32] = {
+        0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+        0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+    };
+    static const uint8_t twoBlock[32] = {
+        0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+        0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1,
+    };
+    static const char* msg = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    uint8_t out[32];
+    digestOf(NULL, 0, 1, out);
+    TEST_ASSERT_EQUAL_MEMORY(empty, out, 32);
+    digestOf((const uint8_t*)"abc", 3, 3, out);
+    TEST_ASSERT_EQUAL_MEMORY(abc, out, 32);
+    digestOf((const uint8_t*)msg, strlen(msg), strlen(msg), out);
+    TEST_ASSERT_EQUAL_MEMORY(twoBlock, out, 32);
+}
+
+// One million 'a', fed in uneven pieces
+static void test_million_a_in_any_split() {
+    static const uint8_t expected[32] = {
+        0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92, 0x81, 0xa1, 0xc7, 0xe2, 0x84, 0xd7, 0x3e, 0x67,
+        0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97, 0x20, 0x0e, 0x04, 0x6d, 0x39, 0xcc, 0xc7, 0x11, 0x2c, 0xd0,
+    };
+    static uint8_t data[1000000];
+    memset(data, 'a', sizeof(data));
+    uint8_t out[32];
+    const size_t pieces[] = { 1, 63, 64, 65, 4096, sizeof(data) };
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+        digestOf(data, sizeof(data), pieces[i], out);
+        TEST_ASSERT_EQUAL_MEMORY(expected, out, 32);
+    }
+}
+
+// Lengths around the padding boundary (55/56 bytes fit or spill the length)
+static void test_padding_boundaries() {
+    static const uint8_t expected55[32] = {
+        0xd5, 0xe2, 0x85, 0x68, 0x3c, 0xd4, 0xef, 0xc0, 0x2d, 0x02, 0x1a, 0x5c, 0x62, 0x01, 0x46, 0x94,
+        0x95, 0x89, 0x01, 0x00, 0x5d, 0x6f, 0x71, 0xe8, 0x9e, 0x09, 0x89, 0xfa, 0xc7, 0x7e, 0x40, 0x72,
+    };
+    static const uint8_t expected56[32] = {
+        0x04, 0xc2, 0x62, 0x61, 0x37, 0x0e, 0xe7, 0x54, 0x15, 0x49, 0xd1, 0x6d, 0xee, 0x32, 0x0c, 0x72,
+        0x3e, 0x3f, 0xd1, 0x46, 0x71, 0xe6, 0x6a, 0x09, 0x9a, 0xfe, 0x0a, 0x37, 0x7c, 0x16, 0x88, 0x8e,
+    };
+    uint8_t data[64];
+    memset(data, 'x', sizeof(data));
+    uint8_t out[32];
+    digestOf(data, 55, 55, out);
+    TEST_ASSERT_EQUAL_MEMORY(expected55, out, 32);
+    digestOf(data, 56, 7, out);
+    TEST_ASSERT_EQUAL_MEMORY(expected56, out, 32);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_known_vectors);
+    RUN_TEST(test_million_a_in_any_split);
+    RUN_TEST(test_padding_boundaries);
+    return UNITY_END();
+}
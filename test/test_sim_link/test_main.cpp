@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <unity.h>
+#include "../sim/SimModem.h"
+#include "../sim/SimHttp.h"
+
+static const char* URL = "http://sim/bootcode.bin";
+static uint8_t* body;
+static int urcCount;
+
+static void onQind(const char*) {
+    urcCount++;
+}
+
+void setUp() {
+    body = (uint8_t*)malloc(simDefaults().imageSize);
+    urcCount = 0;
+}
+
+void tearDown() {
+    free(body);
+}
+
+static void checkImage(long len) {
+    for (long i = 0; i < len; i++) {
+        if (body[i] != simImageByte(i)) TEST_FAIL_MESSAGE("body byte differs");
+    }
+}
+
+// Downloads URL on sim; returns the virtual ms the body took
+static uint32_t download(SimModem& sim, AtChannel& ch, long& got) {
+    int status;
+    long length;
+    HttpHeaderParser h;
+    TEST_ASSERT_TRUE(simHttpGet(ch, URL, NULL, status, length));
+    TEST_ASSERT_EQUAL_INT(200, status);
+    uint32_t start = sim.millis();
+    got = simHttpRead(ch, h, body, length);
+    TEST_ASSERT_EQUAL_INT(length, h.contentLength);
+    TEST_ASSERT_EQUAL_STRING("\"sim-1\"", h.validators.etag);
+    return sim.millis() - start;
+}
+
+static void test_full_download_is_intact_and_at_line_rate() {
+    SimConfig cfg = simDefaults();
+    SimModem sim(cfg);
+    AtChannel ch = { &sim, {}, {} };
+    long got;
+    uint32_t ms = download(sim, ch, got);
+    TEST_ASSERT_EQUAL_INT(cfg.imageSize, got);
+    checkImage(got);
+    TEST_ASSERT_EQUAL_INT(0, sim.dropped);
+
+    // Floor: within 10% of the line rate once the body is flowing (the
+    // read's own latency is the only other cost)
+    double bytesPerSec = got * 1000.0 / (ms - cfg.latencyMs - cfg.jitterMs);
+    TEST_ASSERT_GREATER_OR_EQUAL_INT((long)(cfg.baud / 10 * 0.9), (long)bytesPerSec);
+}
+
+// The modem sends OK and +QHTTPREAD: 0 after the body; the next command must
+// get its own answer, not that one
+static void test_trailing_ok_does_not_answer_the_next_command() {
+    SimModem sim(simDefaults());
+    AtChannel ch = { &sim, {}, {} };
+    long got;
+    download(sim, ch, got);
+    TEST_ASSERT_EQUAL_INT(0, sim.available());
+
+    char csq[32];
+    TEST_ASSERT_TRUE(atQuery(ch, "AT+CSQ", "+CSQ:", csq, sizeof(csq), 1000));
+    TEST_ASSERT_EQUAL_STRING("+CSQ: 21,99", csq);
+    uint32_t sent = sim.millis();
+    TEST_ASSERT_TRUE(atSend(ch, "AT+QIACT=1", "OK", 5000));
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(4 * simDefaults().latencyMs, sim.millis() - sent);
+}
+
+static void test_without_trailing_ok() {
+    SimConfig cfg = simDefaults();
+    cfg.trailingOk = false;
+    SimModem sim(cfg);
+    AtChannel ch = { &sim, {}, {} };
+    long got;
+    download(sim, ch, got);
+    TEST_ASSERT_EQUAL_INT(cfg.imageSize, got);
+    TEST_ASSERT_TRUE(atSend(ch, "AT+CPIN?", "+CPIN: READY", 1000));
+}
+
+static void test_dropouts_stall_but_lose_nothing() {
+    SimConfig cfg = simDefaults();
+    cfg.dropoutEvery = 96 * 1024;
+    SimModem sim(cfg);
+    AtChannel ch = { &sim, {}, {} };
+    long got;
+    uint32_t ms = download(sim, ch, got);
+    TEST_ASSERT_EQUAL_INT(cfg.imageSize, got);
+    checkImage(got);
+    long stalls = (cfg.imageSize - 1) / cfg.dropoutEvery;
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(stalls * cfg.dropoutMs, ms);
+}
+
+// What flow control buys: a reader that falls behind overruns the ring
+static void test_slow_reader_overruns_without_flow_control() {
+    SimConfig cfg = simDefaults();
+    cfg.flowControl = false;
+    cfg.rxCap = 1024;
+    cfg.imageSize = 64 * 1024;
+    SimModem sim(cfg);
+    AtChannel ch = { &sim, {}, {} };
+    int status;
+    long length;
+    TEST_ASSERT_TRUE(simHttpGet(ch, URL, NULL, status, length));
+    sim.println("AT+QHTTPREAD=60");
+    TEST_ASSERT_EQUAL_INT(AT_MATCH, atWaitFor(ch, "CONNECT", 10000, true));
+    uint8_t buf[512];
+    for (int i = 0; i < 20; i++) {
+        sim.advance(50000);  // 50 ms busy elsewhere (a flash erase, say)
+        while (sim.read(buf, sizeof(buf))) {}
+    }
+    TEST_ASSERT_GREATER_THAN_INT(0, sim.dropped);
+}
+
+static void test_urcs_between_commands_are_dispatched() {
+    SimConfig cfg = simDefaults();
+    cfg.urcInterval = 200;
+    SimModem sim(cfg);
+    AtChannel ch = {};
+    ch.link = &sim;
+    TEST_ASSERT_TRUE(atOnUrc(ch, "+QIND:", onQind));
+    for (int i = 0; i < 10; i++) TEST_ASSERT_TRUE(atSend(ch, "AT+CPIN?", "+CPIN: READY", 1000));
+    TEST_ASSERT_GREATER_THAN_INT(0, urcCount);
+}
+
+static void test_unknown_url_is_404() {
+    SimModem sim(simDefaults());
+    AtChannel ch = { &sim, {}, {} };
+    int status;
+    long length;
+    TEST_ASSERT_TRUE(simHttpGet(ch, "http://sim/other.bin", NULL, status, length));
+    TEST_ASSERT_EQUAL_INT(404, status);
+    HttpHeaderParser h;
+    TEST_ASSERT_EQUAL_INT(-1, simHttpRead(ch, h, body, 0));
+}
+
+static void test_matching_etag_is_304() {
+    SimModem sim(simDefaults());
+    AtChannel ch = { &sim, {}, {} };
+    int status;
+    long length;
+    TEST_ASSERT_TRUE(simHttpGet(ch, URL, "GET /bootcode.bin HTTP/1.1\r\nHost: sim\r\nIf-None-Match: \"sim-1\"\r\n\r\n", status, length));
+    TEST_ASSERT_EQUAL_INT(304, status);
+    TEST_ASSERT_EQUAL_INT(0, length);
+}
+
+// One session only re-sends the request header mode when it changes
+static void test_header_mode_is_sent_when_it_changes() {
+    SimModem sim(simDefaults());
+    AtChannel ch = { &sim, {}, {} };
+    QHttpSession s;
+    qhttpSessionReset(s);
+    const char* conditional = "GET /bootcode.bin HTTP/1.1\r\nHost: sim\r\nIf-None-Match: \"sim-1\"\r\n\r\n";
+    int status;
+    long length;
+    TEST_ASSERT_TRUE(simHttpGet(ch, URL, conditional, status, length, &s));
+    TEST_ASSERT_TRUE(simHttpGet(ch, URL, conditional, status, length, &s));
+    TEST_ASSERT_EQUAL_INT(1, sim.headerModeSets);
+    TEST_ASSERT_TRUE(simHttpGet(ch, URL, NULL, status, length, &s));
+    TEST_ASSERT_EQUAL_INT(2, sim.headerModeSets);
+    TEST_ASSERT_EQUAL_INT(200, status);
+    TEST_ASSERT_NULL(s.error);
+}
+
+static void test_unknown_url_read_reports_why() {
+    SimModem sim(simDefaults());
+    AtChannel ch = { &sim, {}, {} };
+    QHttpSession s;
+    qhttpSessionReset(s);
+    int status;
+    long length;
+    TEST_ASSERT_TRUE(qhttpGet(ch, s, "http://sim/other.bin", NULL, status, length));
+    HttpHeaderParser h;
+    TEST_ASSERT_FALSE(qhttpReadBegin(ch, s, 60, h, 10000));
+    TEST_ASSERT_EQUAL_STRING("No CONNECT for the response", s.error);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_full_download_is_intact_and_at_line_rate);
+    RUN_TEST(test_trailing_ok_does_not_answer_the_next_command);
+    RUN_TEST(test_without_trailing_ok);
+    RUN_TEST(test_dropouts_stall_but_lose_nothing);
+    RUN_TEST(test_slow_reader_overruns_without_flow_control);
+    RUN_TEST(test_urcs_between_commands_are_dispatched);
+    RUN_TEST(test_unknown_url_is_404);
+    RUN_TEST(test_matching_etag_is_304);
+    RUN_TEST(test_header_mode_is_sent_when_it_changes);
+    RUN_TEST(test_unknown_url_read_reports_why);
+    return UNITY_END();
+}
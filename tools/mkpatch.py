@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+"""Builds DPT1 delta patches for the firmware's DOWNLOAD_DELTA path.
+
+    mkpatch.py old.bin new.bin [-o out.patch] [--no-gzip]
+    mkpatch.py --selftest
+
+The patch is named after the SHA-256 of the whole base file, which is what
+the device looks up under DELTA_URL_BASE ("<sha256>.patch", see
+deltaPatchName()). For SINK_OTA, old.bin must be the firmware .bin exactly as
+flashed, appended SHA-256 included: the device hashes the running image over
+its esp_image_get_metadata() length. Output is gzip'd unless
+--no-gzip, matching DELTA_PATCH_GZIP. Every patch is applied back to the
+base before it is written, with the same rules as deltaFeed() in
+lib/ModemCore/DeltaPatch.cpp.
+
+Format (all integers little-endian):
+    "DPT1"  u32 targetSize  u8[32] targetSha256
+    repeat: u32 diffLen  u32 extraLen  i32 seek
+            diffLen bytes   added bytewise to base[pos..], pos += diffLen
+            extraLen bytes  copied as-is
+            pos += seek
+"""
+
+import argparse
+import gzip
+import hashlib
+import os
+import random
+import struct
+import sys
+
+MAGIC = b"DPT1"
+KEY_LEN = 16     # Bytes hashed to find match candidates
+KEY_STEP = 4     # Base offsets indexed; matches >= KEY_LEN + KEY_STEP - 1 are always found
+MAX_CANDIDATES = 8
+GIVE_UP = 256    # Stop extending an approximate match after this many bytes without gain
+
+
+def index_base(old):
+    index = {}
+    for j in range(0, len(old) - KEY_LEN + 1, KEY_STEP):
+        slots = index.setdefault(old[j:j + KEY_LEN], [])
+        if len(slots) < MAX_CANDIDATES:
+            slots.append(j)
+    return index
+
+
+def exact_len(old, j, new, i):
+    n = 0
+    limit = min(len(old) - j, len(new) - i)
+    while n < limit and old[j + n] == new[i + n]:
+        n += 1
+    return n
+
+
+def approx_len(old, j, new, i):
+    """bsdiff's forward extension: the length maximising 2*matches - length."""
+    limit = min(len(old) - j, len(new) - i)
+    matches = best = best_len = 0
+    k = 0
+    while k < limit and k - best_len <= GIVE_UP:
+        if old[j + k] == new[i + k]:
+            matches += 1
+        k += 1
+        if matches * 2 - k > best:
+            best = matches * 2 - k
+            best_len = k
+    return best_len
+
+
+def find_matches(old, new):
+    """Non-overlapping (newStart, oldStart, length) runs, increasing in new."""
+    index = index_base(old)
+    matches = []
+    i = 0
+    literal_start = 0
+    while i + KEY_LEN <= len(new):
+        candidates = index.get(new[i:i + KEY_LEN])
+        if not candidates:
+            i += 1
+            continue
+        j = max(candidates, key=lambda c: exact_len(old, c, new, i))
+        # Grow backwards into the pending literal while bytes agree
+        while i > literal_start and j > 0 and old[j - 1] == new[i - 1]:
+            i -= 1
+            j -= 1
+        length = approx_len(old, j, new, i)
+        if length < KEY_LEN:
+            i += 1
+            continue
+        matches.append((i, j, length))
+        i += length
+        literal_start = i
+    return matches
+
+
+def make_patch(old, new):
+    out = bytearray(MAGIC + struct.pack("<I", len(new)) + hashlib.sha256(new).digest())
+    if not new:
+        return bytes(out)
+    matches = find_matches(old, new)
+
+    def record(diff_new, diff_old, diff_len, extra_end, next_old):
+        extra_start = diff_new + diff_len
+        seek = (next_old - (diff_old + diff_len)) if next_old is not None else 0
+        out.extend(struct.pack("<IIi", diff_len, extra_end - extra_start, seek))
+        out.extend((new[diff_new + k] - old[diff_old + k]) & 0xFF for k in range(diff_len))
+        out.extend(new[extra_start:extra_end])
+
+    # Leading literal (possibly empty), then one record per match
+    first_new = matches[0][0] if matches else len(new)
+    record(0, 0, 0, first_new, matches[0][1] if matches else None)
+    for k, (n, o, length) in enumerate(matches):
+        nxt = matches[k + 1] if k + 1 < len(matches) else None
+        record(n, o, length, nxt[0] if nxt else len(new), nxt[1] if nxt else None)
+    return bytes(out)
+
+
+def patch_name(old):
+    """Same rule as deltaPatchName(): hex SHA-256 of every byte of the base."""
+    return hashlib.sha256(old).hexdigest() + ".patch"
+
+
+def apply_patch(old, patch):
+    """Mirror of deltaFeed(): raises ValueError wherever the device fails."""
+    if len(patch) < 40 or patch[:4] != MAGIC:
+        raise ValueError("not a delta patch")
+    target_size = struct.unpack_from("<I", patch, 4)[0]
+    target_sha = patch[8:40]
+    out = bytearray()
+    pos = 0
+    p = 40
+    while len(out) < target_size:
+        if p + 12 > len(patch):
+            raise ValueError("patch ended early")
+        diff_len, extra_len, seek = struct.unpack_from("<IIi", patch, p)
+        p += 12
+        if len(out) + diff_len + extra_len > target_size:
+            raise ValueError("patch overruns target size")
+        if diff_len and (pos < 0 or pos + diff_len > len(old)):
+            raise ValueError("patch reads past the end of the base image")
+        if p + diff_len + extra_len > len(patch):
+            raise ValueError("patch ended early")
+        out.extend((old[pos + k] + patch[p + k]) & 0xFF for k in range(diff_len))
+        p += diff_len
+        pos += diff_len
+        out.extend(patch[p:p + extra_len])
+        p += extra_len
+        pos += seek
+    if hashlib.sha256(out).digest() != target_sha:
+        raise ValueError("patched image does not match target SHA-256")
+    return bytes(out)
+
+
+def selftest():
+    # Pinned in test/test_delta as well, so both sides keep one naming rule
+    if patch_name(b"abc") != "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad.patch":
+        print("FAIL: patch name rule changed", file=sys.stderr)
+        return 1
+    rng = random.Random(1)
+    cases = [(b"", b""), (b"abc", b""), (b"", os.urandom(100)), (b"x" * 5000, b"x" * 5000)]
+    for _ in range(40):
+        old = bytearray(rng.randbytes(rng.randint(0, 20000)))
+        new = bytearray(old)
+        for _ in range(rng.randint(0, 20)):
+            at = rng.randint(0, len(new))
+            op = rng.choice(("insert", "delete", "flip", "move"))
+            if op == "insert":
+                new[at:at] = rng.randbytes(rng.randint(1, 300))
+            elif op == "delete":
+                del new[at:at + rng.randint(1, 300)]
+            elif op == "flip" and at < len(new):
+                new[at] ^= 1 << rng.randint(0, 7)
+            elif op == "move":
+                piece = new[at:at + 500]
+                del new[at:at + 500]
+                to = rng.randint(0, len(new))
+                new[to:to] = piece
+        cases.append((bytes(old), bytes(new)))
+    for old, new in cases:
+        patch = make_patch(old, new)
+        if apply_patch(old, patch) != new:
+            print("FAIL: round trip mismatch", file=sys.stderr)
+            return 1
+        # Corruption must be caught by the digest or the structural checks
+        if len(patch) > 40:
+            bad = bytearray(patch)
+            bad[rng.randrange(40, len(bad))] ^= 0x55
+            try:
+                if apply_patch(old, bytes(bad)) == new:
+                    print("FAIL: corrupted patch accepted", file=sys.stderr)
+                    return 1
+            except ValueError:
+                pass
+    print("selftest: %d round trips OK" % len(cases))
+    return 0
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("old", nargs="?", help="base image the device holds now")
+    ap.add_argument("new", nargs="?", help="target image")
+    ap.add_argument("-o", "--output", help="default: <sha256 of old>.patch")
+    ap.add_argument("--no-gzip", action="store_true", help="for DELTA_PATCH_GZIP false")
+    ap.add_argument("--selftest", action="store_true", help="round-trip random edits and exit")
+    args = ap.parse_args()
+    if args.selftest:
+        return selftest()
+    if not args.old or not args.new:
+        ap.error("old and new are required")
+
+    with open(args.old, "rb") as f:
+        old = f.read()
+    with open(args.new, "rb") as f:
+        new = f.read()
+    patch = make_patch(old, new)
+    apply_patch(old, patch)  # Never ship a patch the device would reject
+
+    body = patch if args.no_gzip else gzip.compress(patch, mtime=0)
+    name = args.output or patch_name(old)
+    with open(name, "wb") as f:
+        f.write(body)
+    print("%s: %d bytes (%d before gzip) for a %d byte image"
+          % (name, len(body), len(patch), len(new)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())